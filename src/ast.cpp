@@ -2,6 +2,9 @@
 
 #include <iostream>
 #include <format>
+#include <unordered_map>
+
+#include "search.hpp"
 
 namespace fs = std::filesystem;
 
@@ -26,6 +29,22 @@ fs::path format_path(const std::string& path)
     }
 }
 
+// a file the script writes to, which only needs its directory to exist
+fs::path format_output_path(const std::string& path)
+{
+    if (!path.size())
+    {
+        throw std::runtime_error("compilation error: cannot specify an empty path");
+    }
+
+    fs::path output_path = path.substr(0, 2) == "~/" ? fs::path(getenv("HOME")) / fs::path(path.substr(2)) : fs::path(path);
+    if (!fs::is_directory(output_path.parent_path().empty() ? fs::path(".") : output_path.parent_path()))
+    {
+        throw std::runtime_error(std::format("compilation error: {} does not exist", output_path.parent_path().string()));
+    }
+    return fs::weakly_canonical(output_path);
+}
+
 std::uint64_t select_specifier(lexer::TokenType select_type)
 {
     switch (select_type)
@@ -34,6 +53,9 @@ std::uint64_t select_specifier(lexer::TokenType select_type)
     case lexer::TokenType::FILES: return 0b01;
     case lexer::TokenType::DIRECTORIES: return 0b10;
     case lexer::TokenType::RECURSIVE: return 0b00;
+    case lexer::TokenType::DUPLICATES: return 0b100;
+    case lexer::TokenType::MANIFEST: return 0b1000;
+    case lexer::TokenType::STDIN: return 0b10000;
     default: std::unreachable();
     }
 }
@@ -53,6 +75,43 @@ void AtomicElement::emit(std::vector<Instr>& program)
     program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(&m_path) });
 }
 
+ManifestElement::ManifestElement(const std::string& path)
+{
+    // the manifest may be saved by an earlier statement of the same script, so it only has to exist once it is read
+    m_path = format_output_path(path);
+}
+
+void ManifestElement::emit(std::vector<Instr>& program)
+{
+    // a manifest is read by a cluster of its own without rule or traversal limits
+    program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(&m_path) });
+    program.emplace_back(Instr{ InstrType::PUSH, nullptr });
+    program.emplace_back(Instr{ InstrType::PUSH, nullptr });
+    program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(select_specifier(lexer::TokenType::MANIFEST)) });
+    program.emplace_back(Instr{ InstrType::CREATE_CLUSTER, reinterpret_cast<void*>(1) });
+}
+
+void ManifestElement::collect_reads(Footprint& footprint)
+{
+    // the entries of a manifest can be anywhere
+    footprint.m_reads.emplace_back(m_path);
+    footprint.m_reads.emplace_back("/");
+}
+
+void StdinElement::collect_reads(Footprint& footprint)
+{
+    footprint.m_reads_stdin = true;
+    footprint.m_reads.emplace_back("/");
+}
+
+void StdinElement::emit(std::vector<Instr>& program)
+{
+    program.emplace_back(Instr{ InstrType::PUSH, nullptr });
+    program.emplace_back(Instr{ InstrType::PUSH, nullptr });
+    program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(select_specifier(lexer::TokenType::STDIN)) });
+    program.emplace_back(Instr{ InstrType::CREATE_CLUSTER, reinterpret_cast<void*>(0) });
+}
+
 bool CompoundElement::conflicting_select_type(lexer::TokenType parent_select_type)
 {
     bool remaining_children = false;
@@ -68,7 +127,25 @@ bool CompoundElement::conflicting_select_type(lexer::TokenType parent_select_typ
         }
     }
     return !remaining_children || ((parent_select_type == lexer::TokenType::DIRECTORIES) && 
-        ((m_select_type == lexer::TokenType::FILES) || (m_select_type == lexer::TokenType::RECURSIVE)));
+        ((m_select_type == lexer::TokenType::FILES) || (m_select_type == lexer::TokenType::RECURSIVE) ||
+        (m_select_type == lexer::TokenType::DUPLICATES)));
+}
+
+void CompoundElement::collect_reads(Footprint& footprint)
+{
+    for (const auto& element : m_elements)
+    {
+        if (element)
+        {
+            element->collect_reads(footprint);
+        }
+    }
+
+    // links can lead anywhere
+    if (m_traversal && m_traversal->m_follow_symlinks)
+    {
+        footprint.m_reads.emplace_back("/");
+    }
 }
 
 void CompoundElement::emit(std::vector<Instr>& program)
@@ -98,6 +175,7 @@ void CompoundElement::emit(std::vector<Instr>& program)
     {
         program.emplace_back(Instr{ InstrType::PUSH, nullptr });
     }
+    program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(m_traversal.get()) });
 
     auto specifier = select_specifier(m_select_type);
     program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(specifier) });
@@ -107,10 +185,30 @@ void CompoundElement::emit(std::vector<Instr>& program)
     {
         program.emplace_back(Instr{ InstrType::MERGE_CLUSTERS, reinterpret_cast<void*>(n_clusters) });
     }
+
+    if (m_memo)
+    {
+        program.emplace_back(Instr{ InstrType::MEMOIZE, reinterpret_cast<void*>(m_memo.get()) });
+    }
 }
 
 void Query::emit(std::vector<Instr>& program)
 {
+    m_footprint = Footprint();
+    for (const auto& element : m_elements)
+    {
+        if (element)
+        {
+            element->collect_reads(m_footprint);
+        }
+    }
+    if (m_traversal && m_traversal->m_follow_symlinks)
+    {
+        m_footprint.m_reads.emplace_back("/");
+    }
+    m_disk_operation->collect_writes(m_footprint);
+    program.emplace_back(Instr{ InstrType::QUERY, reinterpret_cast<void*>(&m_footprint) });
+
     std::uint64_t n_paths = 0, n_clusters = 0;
     for (const auto& element : m_elements)
     {
@@ -136,6 +234,7 @@ void Query::emit(std::vector<Instr>& program)
     {
         program.emplace_back(Instr{ InstrType::PUSH, nullptr });
     }                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                         
+    program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(m_traversal.get()) });
 
     auto specifier = select_specifier(m_select_type);
     program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(specifier) });
@@ -145,6 +244,16 @@ void Query::emit(std::vector<Instr>& program)
     {
         program.emplace_back(Instr{ InstrType::MERGE_CLUSTERS, reinterpret_cast<void*>(n_clusters) });
     }
+
+    if (m_ordering)
+    {
+        program.emplace_back(Instr{ InstrType::ORDER, reinterpret_cast<void*>(m_ordering.get()) });
+    }
+
+    if (m_limit)
+    {
+        program.emplace_back(Instr{ InstrType::LIMIT, reinterpret_cast<void*>(*m_limit) });
+    }
 }
 
 void DisplayOp::emit(std::vector<Instr>& program)
@@ -157,6 +266,12 @@ void DeleteOp::emit(std::vector<Instr>& program)
     program.emplace_back(Instr{ InstrType::DELETE });
 }
 
+void DeleteOp::collect_writes(Footprint& footprint)
+{
+    footprint.m_writes = footprint.m_reads;
+    footprint.m_journaled = true;
+}
+
 MoveOp::MoveOp(const std::string& path)
 {
     m_destination_path = format_path(path);
@@ -167,6 +282,13 @@ void MoveOp::emit(std::vector<Instr>& program)
     program.emplace_back(Instr{ InstrType::MOVE, reinterpret_cast<void*>(&m_destination_path) });
 }
 
+void MoveOp::collect_writes(Footprint& footprint)
+{
+    footprint.m_writes = footprint.m_reads;
+    footprint.m_writes.emplace_back(m_destination_path);
+    footprint.m_journaled = true;
+}
+
 CopyOp::CopyOp(const std::string& path)
 {
     m_destination_path = format_path(path);
@@ -177,6 +299,49 @@ void CopyOp::emit(std::vector<Instr>& program)
     program.emplace_back(Instr{ InstrType::COPY, reinterpret_cast<void*>(&m_destination_path) });
 }
 
+void CopyOp::collect_writes(Footprint& footprint)
+{
+    footprint.m_writes.emplace_back(m_destination_path);
+    footprint.m_journaled = true;
+}
+
+SyncOp::SyncOp(const std::string& path, bool checksum, bool dry_run)
+{
+    m_sync.m_destination_path = format_path(path);
+    m_sync.m_checksum = checksum;
+    m_sync.m_dry_run = dry_run;
+}
+
+void SyncOp::emit(std::vector<Instr>& program)
+{
+    program.emplace_back(Instr{ InstrType::SYNC, reinterpret_cast<void*>(&m_sync) });
+}
+
+void SyncOp::collect_writes(Footprint& footprint)
+{
+    footprint.m_writes.emplace_back(m_sync.m_destination_path);
+}
+
+SaveOp::SaveOp(const std::string& path)
+{
+    m_manifest_path = format_output_path(path);
+}
+
+void SaveOp::emit(std::vector<Instr>& program)
+{
+    program.emplace_back(Instr{ InstrType::SAVE, reinterpret_cast<void*>(&m_manifest_path) });
+}
+
+void SaveOp::collect_writes(Footprint& footprint)
+{
+    footprint.m_writes.emplace_back(m_manifest_path);
+}
+
+void AggregateOp::emit(std::vector<Instr>& program)
+{
+    program.emplace_back(Instr{ InstrType::AGGREGATE, reinterpret_cast<void*>(&m_aggregation) });
+}
+
 void Rule::emit(std::vector<Instr>& program)
 {
     program.emplace_back(Instr{ InstrType::PUSH, reinterpret_cast<void*>(&m_predicate) });
@@ -184,37 +349,133 @@ void Rule::emit(std::vector<Instr>& program)
 
 AndRule::AndRule(std::shared_ptr<Rule> lhs, std::shared_ptr<Rule> rhs) : m_lhs(lhs), m_rhs(rhs) 
 {
-    m_predicate = std::function<bool(const fs::path&)>([&](const fs::path& path) {
-        return m_lhs->m_predicate(path) && m_rhs->m_predicate(path);
+    // evaluate the cheaper side first so that expensive predicates only run on what is left over
+    if (m_lhs->m_predicate.m_cost > m_rhs->m_predicate.m_cost)
+    {
+        std::swap(m_lhs, m_rhs);
+    }
+    m_predicate.m_cost = m_lhs->m_predicate.m_cost + m_rhs->m_predicate.m_cost;
+
+    m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+        return m_lhs->m_predicate(entry) && m_rhs->m_predicate(entry);
     });
+
+    if (m_lhs->m_predicate.m_block_function && m_rhs->m_predicate.m_block_function)
+    {
+        m_predicate.m_block_function = [&](const NameBlock& names, NameSelection& selection) {
+            NameSelection rhs_selection;
+            m_lhs->m_predicate.m_block_function(names, selection);
+            m_rhs->m_predicate.m_block_function(names, rhs_selection);
+            for (std::size_t i = 0; i < selection.size(); i++)
+            {
+                selection[i] &= rhs_selection[i];
+            }
+        };
+    }
 }
 
 OrRule::OrRule(std::shared_ptr<Rule> lhs, std::shared_ptr<Rule> rhs) : m_lhs(lhs), m_rhs(rhs) 
 {
-    m_predicate = std::function<bool(const fs::path&)>([&](const fs::path& path) {
-        return m_lhs->m_predicate(path) || m_rhs->m_predicate(path);
+    if (m_lhs->m_predicate.m_cost > m_rhs->m_predicate.m_cost)
+    {
+        std::swap(m_lhs, m_rhs);
+    }
+    m_predicate.m_cost = m_lhs->m_predicate.m_cost + m_rhs->m_predicate.m_cost;
+
+    m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+        return m_lhs->m_predicate(entry) || m_rhs->m_predicate(entry);
     });
+
+    if (m_lhs->m_predicate.m_block_function && m_rhs->m_predicate.m_block_function)
+    {
+        m_predicate.m_block_function = [&](const NameBlock& names, NameSelection& selection) {
+            NameSelection rhs_selection;
+            m_lhs->m_predicate.m_block_function(names, selection);
+            m_rhs->m_predicate.m_block_function(names, rhs_selection);
+            for (std::size_t i = 0; i < selection.size(); i++)
+            {
+                selection[i] |= rhs_selection[i];
+            }
+        };
+    }
 }
 
 ExtensionRule::ExtensionRule(const std::string& extension) : m_extension(extension) 
 {
-    m_predicate = std::function<bool(const fs::path&)>([&](const fs::path& path) {
-        return path.extension() == m_extension;
+    m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+        return entry.path().extension() == m_extension;
+    });
+    m_predicate.m_block_function = [&](const NameBlock& names, NameSelection& selection) {
+        select_extension(names, m_extension, selection);
+    };
+}
+
+NameRule::NameRule(const std::string& pattern, bool regex) 
+    : m_pattern(regex ? NamePattern::regex(pattern) : NamePattern::glob(pattern))
+{
+    m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+        return m_pattern.matches(filename_of(entry.path()));
+    });
+    m_predicate.m_block_function = [&](const NameBlock& names, NameSelection& selection) {
+        select_pattern(names, m_pattern, selection);
+    };
+}
+
+ContentRule::ContentRule(const std::string& pattern) : m_pattern(pattern)
+{
+    m_predicate.m_cost = CONTENT_COST;
+    m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+        return file_contains(entry.path(), m_pattern);
     });
 }
 
 SizeRule::SizeRule(std::uint64_t threshold_size, bool within_threshold) : m_threshold_size(threshold_size)
 {
+    m_predicate.m_cost = METADATA_COST;
     if (within_threshold)
     {
-        m_predicate = std::function<bool(const fs::path&)>([&](const fs::path& path) {
-            return fs::file_size(path) <= m_threshold_size;
+        m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+            return entry.metadata().m_size <= m_threshold_size;
+        });
+    }
+    else
+    {
+        m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+            return entry.metadata().m_size >= m_threshold_size;
+        });
+    }
+}
+
+TimeRule::TimeRule(lexer::TokenType timestamp_type, std::int64_t threshold, bool newer) : m_threshold(threshold)
+{
+    switch (timestamp_type)
+    {
+    case lexer::TokenType::MODIFIED:
+        m_timestamp = &Metadata::m_modified;
+        break;
+    case lexer::TokenType::ACCESSED:
+        m_timestamp = &Metadata::m_accessed;
+        break;
+    case lexer::TokenType::CREATED:
+        m_timestamp = &Metadata::m_created;
+        break;
+    default: std::unreachable();
+    }
+
+    // file systems that do not record creation times never match a created rule
+    m_predicate.m_cost = METADATA_COST;
+    if (newer)
+    {
+        m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+            const auto& metadata = entry.metadata();
+            return (m_timestamp != &Metadata::m_created || metadata.m_has_created) && metadata.*m_timestamp > m_threshold;
         });
     }
     else
     {
-        m_predicate = std::function<bool(const fs::path&)>([&](const fs::path& path) {
-            return fs::file_size(path) >= m_threshold_size;
+        m_predicate.m_function = std::function<bool(Entry&)>([&](Entry& entry) {
+            const auto& metadata = entry.metadata();
+            return (m_timestamp != &Metadata::m_created || metadata.m_has_created) && metadata.*m_timestamp < m_threshold;
         });
     }
 }
@@ -246,15 +507,55 @@ void AST::prune_conflicting_select()
     }
 }
 
+void AST::share_identical_elements()
+{
+    std::unordered_map<std::string, std::vector<CompoundElement*>> occurrences;
+    std::function<void(const std::vector<std::shared_ptr<Element>>&)> collect = [&](const std::vector<std::shared_ptr<Element>>& elements) {
+        for (const auto& element : elements)
+        {
+            if (auto compound = std::dynamic_pointer_cast<CompoundElement>(element))
+            {
+                if (!compound->m_key.empty())
+                {
+                    occurrences[compound->m_key].emplace_back(compound.get());
+                }
+                collect(compound->m_elements);
+            }
+        }
+    };
+
+    for (const auto& query : m_queries)
+    {
+        if (query)
+        {
+            collect(query->m_elements);
+        }
+    }
+
+    for (const auto& [key, elements] : occurrences)
+    {
+        if (elements.size() > 1)
+        {
+            auto memo = std::make_shared<Memo>();
+            for (auto element : elements)
+            {
+                element->m_memo = memo;
+            }
+        }
+    }
+}
+
 std::vector<Instr> AST::compile()
 {
+    share_identical_elements();
+
     std::vector<Instr> program;
-    for (int i = m_queries.size() - 1; i >= 0; i--)
+    for (const auto& query : m_queries)
     {
-        if (m_queries[i])
+        if (query)
         {
-            m_queries[i]->emit(program);
-            m_queries[i]->m_disk_operation->emit(program);
+            query->emit(program);
+            query->m_disk_operation->emit(program);
         }
     }
     return program;
@@ -3,15 +3,17 @@
 
 #include <functional>
 #include <filesystem>
+#include <optional>
 
 #include "lexer.hpp"
+#include "pattern.hpp"
 #include "runtime_types.hpp"
 
 struct Rule
 {
     void emit(std::vector<Instr>& program);
 
-    std::function<bool(const std::filesystem::path&)> m_predicate;
+    Predicate m_predicate;
 };
 
 class AndRule : public Rule
@@ -43,6 +45,24 @@ class ExtensionRule : public Rule
         const std::string& m_extension;
 };
 
+class NameRule : public Rule
+{
+    public:
+        NameRule(const std::string& pattern, bool regex);
+
+    private:
+        NamePattern m_pattern;
+};
+
+class ContentRule : public Rule
+{
+    public:
+        ContentRule(const std::string& pattern);
+
+    private:
+        std::string m_pattern;
+};
+
 class SizeRule : public Rule
 {
     public:
@@ -52,10 +72,24 @@ class SizeRule : public Rule
         std::uint64_t m_threshold_size;
 };
 
+class TimeRule : public Rule
+{
+    public:
+        // matches entries whose timestamp is after threshold when newer is set, and before it otherwise
+        TimeRule(lexer::TokenType timestamp_type, std::int64_t threshold, bool newer);
+
+    private:
+        std::int64_t Metadata::* m_timestamp;
+        std::int64_t m_threshold;
+};
+
 struct Element
 {
     virtual void emit(std::vector<Instr>& program) = 0;
 
+    // adds what the element reads to the footprint of its query
+    virtual void collect_reads(Footprint& footprint) = 0;
+
     virtual bool is_atomic_element() = 0;
     virtual bool conflicting_select_type(lexer::TokenType parent_select_type) = 0;
 };
@@ -66,6 +100,7 @@ class AtomicElement : public Element
         AtomicElement(const std::string& path);
 
         void emit(std::vector<Instr>& program);
+        void collect_reads(Footprint& footprint) { footprint.m_reads.emplace_back(m_path); };
 
         bool is_atomic_element() { return true; };
         bool conflicting_select_type(lexer::TokenType parent_select_type);
@@ -80,6 +115,7 @@ class CompoundElement : public Element
         CompoundElement(lexer::TokenType select_type) : m_select_type(select_type) {};
 
         void emit(std::vector<Instr>& program);
+        void collect_reads(Footprint& footprint);
 
         bool is_atomic_element() { return false; };
         bool conflicting_select_type(lexer::TokenType parent_select_type);
@@ -87,14 +123,51 @@ class CompoundElement : public Element
     public:
         std::vector<std::shared_ptr<Element>> m_elements;
         std::shared_ptr<Rule> m_rule;
+        std::shared_ptr<Traversal> m_traversal;
+
+        // sub-queries written the same way have the same key, empty when the results cannot be reused
+        std::string m_key;
+
+        // shared by all the sub-queries of a script with the same key, if there are several
+        std::shared_ptr<Memo> m_memo;
 
     private:
         lexer::TokenType m_select_type;
 };
 
+// entries read back from a manifest, which are handed to the enclosing query like the contents of a path
+class ManifestElement : public Element
+{
+    public:
+        ManifestElement(const std::string& path);
+
+        void emit(std::vector<Instr>& program);
+        void collect_reads(Footprint& footprint);
+
+        bool is_atomic_element() { return false; };
+        bool conflicting_select_type(lexer::TokenType) { return false; };
+
+    private:
+        std::filesystem::path m_path;
+};
+
+// paths read from standard input (or the --paths-from file) while the query runs
+class StdinElement : public Element
+{
+    public:
+        void emit(std::vector<Instr>& program);
+        void collect_reads(Footprint& footprint);
+
+        bool is_atomic_element() { return false; };
+        bool conflicting_select_type(lexer::TokenType) { return false; };
+};
+
 struct DiskOperation
 {
     virtual void emit(std::vector<Instr>& program) = 0;
+
+    // adds what the operation changes to the footprint of its query, which already holds what it reads
+    virtual void collect_writes(Footprint&) {};
 };
 
 class DisplayOp : public DiskOperation
@@ -107,6 +180,7 @@ class DeleteOp : public DiskOperation
 {
     public:
         void emit(std::vector<Instr>& program);
+        void collect_writes(Footprint& footprint);
 };
 
 class CopyOp : public DiskOperation
@@ -115,6 +189,7 @@ class CopyOp : public DiskOperation
         CopyOp(const std::string& path);
 
         void emit(std::vector<Instr>& program);
+        void collect_writes(Footprint& footprint);
 
     public:
         std::filesystem::path m_destination_path;
@@ -126,11 +201,47 @@ class MoveOp : public DiskOperation
         MoveOp(const std::string& path);
 
         void emit(std::vector<Instr>& program);
+        void collect_writes(Footprint& footprint);
 
     public:
         std::filesystem::path m_destination_path;
 };
 
+class SyncOp : public DiskOperation
+{
+    public:
+        SyncOp(const std::string& path, bool checksum, bool dry_run);
+
+        void emit(std::vector<Instr>& program);
+        void collect_writes(Footprint& footprint);
+
+    public:
+        Sync m_sync;
+};
+
+class SaveOp : public DiskOperation
+{
+    public:
+        SaveOp(const std::string& path);
+
+        void emit(std::vector<Instr>& program);
+        void collect_writes(Footprint& footprint);
+
+    public:
+        std::filesystem::path m_manifest_path;
+};
+
+class AggregateOp : public DiskOperation
+{
+    public:
+        AggregateOp(const Aggregation& aggregation) : m_aggregation(aggregation) {};
+
+        void emit(std::vector<Instr>& program);
+
+    public:
+        Aggregation m_aggregation;
+};
+
 class Query
 {
     public:
@@ -142,7 +253,13 @@ class Query
         lexer::TokenType m_select_type;
         std::vector<std::shared_ptr<Element>> m_elements;
         std::shared_ptr<Rule> m_rule;
+        std::shared_ptr<Traversal> m_traversal;
         std::shared_ptr<DiskOperation> m_disk_operation;
+        std::shared_ptr<Ordering> m_ordering;
+        std::optional<std::uint64_t> m_limit;
+
+        // filled in when the query is emitted
+        Footprint m_footprint;
 };
 
 struct AST
@@ -153,6 +270,10 @@ struct AST
         // removes compound elements from the AST that conflict with the parent's select specifier 
         void prune_conflicting_select();
 
+    private:
+        // lets the sub-queries that occur more than once in the script share their results
+        void share_identical_elements();
+
     public:
         std::vector<std::shared_ptr<Query>> m_queries;
 };
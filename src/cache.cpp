@@ -0,0 +1,87 @@
+#include "cache.hpp"
+
+#include "entry.hpp"
+#include "fd_budget.hpp"
+
+namespace fs = std::filesystem;
+
+std::shared_ptr<const DirectoryListing> read_directory(const fs::path& directory)
+{
+    // a directory is read in full and closed again before any of its subdirectories is opened, so a walk
+    // holds one descriptor per worker no matter how deep the tree is
+    auto lease = FdBudget::shared().lease();
+    return retry_exhausted_descriptors([&]() {
+        auto listing = std::make_shared<DirectoryListing>();
+
+        // the mtime is taken before reading so that a change made mid-read invalidates the listing
+        listing->m_mtime = fs::last_write_time(directory);
+        for (const auto& entry : fs::directory_iterator(directory))
+        {
+            listing->m_entries.emplace_back(entry);
+            listing->m_names.add(filename_of(entry.path()));
+        }
+        return std::shared_ptr<const DirectoryListing>(listing);
+    });
+}
+
+std::shared_ptr<const DirectoryListing> MetadataCache::list(const fs::path& directory)
+{
+    auto mtime = fs::last_write_time(directory);
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto slot = m_slots.find(directory);
+        if (slot != m_slots.end())
+        {
+            if (slot->second.m_listing->m_mtime == mtime)
+            {
+                m_lru.splice(m_lru.begin(), m_lru, slot->second.m_lru);
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return slot->second.m_listing;
+            }
+
+            m_size -= slot->second.m_listing->m_entries.size();
+            m_lru.erase(slot->second.m_lru);
+            m_slots.erase(slot);
+        }
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    auto listing = read_directory(directory);
+    insert(directory, listing);
+    return listing;
+}
+
+void MetadataCache::insert(const fs::path& directory, std::shared_ptr<const DirectoryListing> listing)
+{
+    if (listing->m_entries.size() > m_capacity)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    // another thread may have listed the same directory in the meantime
+    if (m_slots.contains(directory))
+    {
+        return;
+    }
+
+    while (m_size + listing->m_entries.size() > m_capacity)
+    {
+        auto evicted = m_slots.find(m_lru.back());
+        m_size -= evicted->second.m_listing->m_entries.size();
+        m_slots.erase(evicted);
+        m_lru.pop_back();
+    }
+
+    m_lru.push_front(directory);
+    m_slots.emplace(directory, Slot{ listing, m_lru.begin() });
+    m_size += listing->m_entries.size();
+}
+
+std::size_t MetadataCache::size()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_size;
+}
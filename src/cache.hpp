@@ -0,0 +1,61 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <atomic>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "name_block.hpp"
+
+struct DirectoryListing
+{
+    std::filesystem::file_time_type m_mtime;
+    std::vector<std::filesystem::directory_entry> m_entries;
+
+    // the names of m_entries in the same order
+    NameBlock m_names;
+};
+
+// reads the contents of a directory without consulting any cache
+std::shared_ptr<const DirectoryListing> read_directory(const std::filesystem::path& directory);
+
+// bounded LRU of directory listings that is kept alive across statements. a cached listing is
+// revalidated against the directory's mtime before it is reused, so a hit costs a single stat.
+class MetadataCache
+{
+    public:
+        MetadataCache(std::size_t capacity = 1 << 20) : m_capacity(capacity), m_size(0), m_hits(0), m_misses(0) {};
+
+        std::shared_ptr<const DirectoryListing> list(const std::filesystem::path& directory);
+
+        std::uint64_t hits() const { return m_hits.load(std::memory_order_relaxed); };
+        std::uint64_t misses() const { return m_misses.load(std::memory_order_relaxed); };
+        std::size_t size();
+
+    private:
+        void insert(const std::filesystem::path& directory, std::shared_ptr<const DirectoryListing> listing);
+
+    private:
+        struct Slot
+        {
+            std::shared_ptr<const DirectoryListing> m_listing;
+            std::list<std::filesystem::path>::iterator m_lru;
+        };
+
+        std::mutex m_mutex;
+        std::list<std::filesystem::path> m_lru;
+        std::unordered_map<std::filesystem::path, Slot> m_slots;
+
+        // capacity and size are counted in directory entries rather than directories
+        std::size_t m_capacity;
+        std::size_t m_size;
+
+        std::atomic<std::uint64_t> m_hits;
+        std::atomic<std::uint64_t> m_misses;
+};
+
+#endif
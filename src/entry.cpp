@@ -0,0 +1,158 @@
+#include "entry.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/sysmacros.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    fs::file_type file_type(std::uint32_t mode)
+    {
+        switch (mode & S_IFMT)
+        {
+        case S_IFREG: return fs::file_type::regular;
+        case S_IFDIR: return fs::file_type::directory;
+        case S_IFLNK: return fs::file_type::symlink;
+        case S_IFBLK: return fs::file_type::block;
+        case S_IFCHR: return fs::file_type::character;
+        case S_IFIFO: return fs::file_type::fifo;
+        case S_IFSOCK: return fs::file_type::socket;
+        default: return fs::file_type::unknown;
+        }
+    }
+
+    std::int64_t nanoseconds(std::int64_t seconds, std::int64_t nanoseconds)
+    {
+        return seconds * 1'000'000'000 + nanoseconds;
+    }
+}
+
+const Metadata& Entry::metadata()
+{
+    if (m_has_metadata)
+    {
+        return m_metadata;
+    }
+
+#if defined(__linux__)
+    struct statx status;
+    auto mask = STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_ATIME | STATX_BTIME;
+    if (statx(AT_FDCWD, m_path->c_str(), AT_STATX_SYNC_AS_STAT, mask, &status) != 0)
+    {
+        throw fs::filesystem_error("could not stat", *m_path, std::error_code(errno, std::generic_category()));
+    }
+
+    m_metadata.m_type = file_type(status.stx_mode);
+    m_metadata.m_size = status.stx_size;
+    m_metadata.m_device = makedev(status.stx_dev_major, status.stx_dev_minor);
+    m_metadata.m_inode = status.stx_ino;
+    m_metadata.m_modified = nanoseconds(status.stx_mtime.tv_sec, status.stx_mtime.tv_nsec);
+    m_metadata.m_accessed = nanoseconds(status.stx_atime.tv_sec, status.stx_atime.tv_nsec);
+    m_metadata.m_created = nanoseconds(status.stx_btime.tv_sec, status.stx_btime.tv_nsec);
+    m_metadata.m_has_created = status.stx_mask & STATX_BTIME;
+#else
+    struct stat status;
+    if (stat(m_path->c_str(), &status) != 0)
+    {
+        throw fs::filesystem_error("could not stat", *m_path, std::error_code(errno, std::generic_category()));
+    }
+
+    m_metadata.m_type = file_type(status.st_mode);
+    m_metadata.m_size = status.st_size;
+    m_metadata.m_device = status.st_dev;
+    m_metadata.m_inode = status.st_ino;
+#if defined(__APPLE__)
+    m_metadata.m_modified = nanoseconds(status.st_mtimespec.tv_sec, status.st_mtimespec.tv_nsec);
+    m_metadata.m_accessed = nanoseconds(status.st_atimespec.tv_sec, status.st_atimespec.tv_nsec);
+    m_metadata.m_created = nanoseconds(status.st_birthtimespec.tv_sec, status.st_birthtimespec.tv_nsec);
+    m_metadata.m_has_created = true;
+#else
+    m_metadata.m_modified = nanoseconds(status.st_mtim.tv_sec, status.st_mtim.tv_nsec);
+    m_metadata.m_accessed = nanoseconds(status.st_atim.tv_sec, status.st_atim.tv_nsec);
+    m_metadata.m_created = 0;
+    m_metadata.m_has_created = false;
+#endif
+#endif
+
+    m_has_metadata = true;
+    return m_metadata;
+}
+
+bool Entry::unchanged()
+{
+    if (!m_recorded)
+    {
+        return true;
+    }
+
+    auto recorded = m_metadata;
+    m_has_metadata = false;
+    m_recorded = false;
+    try
+    {
+        const auto& current = metadata();
+        return current.m_device == recorded.m_device && current.m_inode == recorded.m_inode &&
+            current.m_size == recorded.m_size && current.m_modified == recorded.m_modified;
+    }
+    catch(const fs::filesystem_error& e)
+    {
+        return false;
+    }
+}
+
+fs::file_type Entry::listed_type(const fs::directory_entry& entry)
+{
+    // these only fall back to a stat when the file system did not report a type while listing
+    if (entry.is_symlink())
+    {
+        return fs::file_type::symlink;
+    }
+    else if (entry.is_directory())
+    {
+        return fs::file_type::directory;
+    }
+    else if (entry.is_regular_file())
+    {
+        return fs::file_type::regular;
+    }
+
+    // other types are rare enough to be resolved with the metadata when they are asked about
+    return fs::file_type::none;
+}
+
+fs::file_type Entry::resolved_type()
+{
+    if (m_type != fs::file_type::none && m_type != fs::file_type::symlink)
+    {
+        return m_type;
+    }
+
+    // dangling symbolic links and paths that vanished are neither files nor directories
+    try
+    {
+        return metadata().m_type;
+    }
+    catch(const fs::filesystem_error& e)
+    {
+        return fs::file_type::not_found;
+    }
+}
+
+bool Entry::exists()
+{
+    return resolved_type() != fs::file_type::not_found;
+}
+
+bool Entry::is_directory()
+{
+    return resolved_type() == fs::file_type::directory;
+}
+
+bool Entry::is_regular_file()
+{
+    return resolved_type() == fs::file_type::regular;
+}
@@ -0,0 +1,95 @@
+#ifndef ENTRY_HPP
+#define ENTRY_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+// the last component of a path, without allocating like path::filename() does
+inline std::string_view filename_of(const std::filesystem::path& path)
+{
+    std::string_view native = path.native();
+    return native.substr(native.find_last_of('/') + 1);
+}
+
+// timestamps are in nanoseconds since the unix epoch
+struct Metadata
+{
+    std::filesystem::file_type m_type;
+    std::uint64_t m_size;
+    std::uint64_t m_device;
+    std::uint64_t m_inode;
+    std::int64_t m_modified;
+    std::int64_t m_accessed;
+    std::int64_t m_created;
+    bool m_has_created;
+};
+
+// a path met during traversal. its metadata is fetched with a single statx call the first time a rule
+// or an operation asks for it, and is shared by everything that looks at the entry afterwards.
+class Entry
+{
+    public:
+        Entry(const std::filesystem::path& path)
+            : m_path(&path), m_type(std::filesystem::file_type::none), m_has_metadata(false), m_recorded(false) {};
+
+        // an entry read back from a manifest, whose metadata was recorded when the manifest was saved. the
+        // metadata follows symbolic links, so it does not tell the type of the entry itself.
+        Entry(const std::filesystem::path& path, const Metadata& metadata)
+            : m_path(&path), m_type(std::filesystem::file_type::none), m_has_metadata(true), m_recorded(true), m_metadata(metadata) {};
+
+        // the type of a listed entry is known from the directory itself and costs no extra syscall
+        Entry(const std::filesystem::directory_entry& entry)
+            : m_path(&entry.path()), m_type(listed_type(entry)), m_has_metadata(false), m_recorded(false) {};
+
+        // a copy of entry that refers to path instead, for keeping an entry beyond the path it was made from
+        Entry(const std::filesystem::path& path, const Entry& entry)
+            : m_path(&path), m_type(entry.m_type), m_has_metadata(entry.m_has_metadata), m_recorded(entry.m_recorded),
+            m_metadata(entry.m_metadata) {};
+
+        // an entry whose own type was learned earlier, see known_type()
+        Entry(const std::filesystem::path& path, std::filesystem::file_type type)
+            : m_path(&path), m_type(type), m_has_metadata(false), m_recorded(false) {};
+
+        // an entry refers to its path instead of copying it, so it cannot be made from a temporary one
+        Entry(std::filesystem::path&&) = delete;
+        Entry(std::filesystem::path&&, const Metadata&) = delete;
+        Entry(std::filesystem::directory_entry&&) = delete;
+        Entry(std::filesystem::path&&, const Entry&) = delete;
+        Entry(std::filesystem::path&&, std::filesystem::file_type) = delete;
+
+        const std::filesystem::path& path() const { return *m_path; };
+
+        // the type of the entry itself when it is known without a stat, none otherwise
+        std::filesystem::file_type known_type() const { return m_type; };
+
+        // follows symbolic links, throws std::filesystem::filesystem_error when the path cannot be stat'ed
+        const Metadata& metadata();
+
+        bool exists();
+        bool is_directory();
+        bool is_regular_file();
+
+        // whether the entry is still what its recorded metadata describes, stat'ing it again only when
+        // the metadata was recorded earlier. disk operations check this before acting on an entry.
+        bool unchanged();
+
+    private:
+        std::filesystem::file_type resolved_type();
+
+        // the type the directory listing recorded for entry. symlink_status() would stat the entry again.
+        static std::filesystem::file_type listed_type(const std::filesystem::directory_entry& entry);
+
+    private:
+        // not owned, the path has to outlive the entry
+        const std::filesystem::path* m_path;
+
+        // type of the entry itself, without following symbolic links (none when unknown)
+        std::filesystem::file_type m_type;
+
+        bool m_has_metadata;
+        bool m_recorded;
+        Metadata m_metadata;
+};
+
+#endif
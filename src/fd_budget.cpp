@@ -0,0 +1,55 @@
+#include "fd_budget.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+namespace fs = std::filesystem;
+
+FdBudget& FdBudget::shared()
+{
+    static FdBudget budget([]() {
+        constexpr rlim_t FALLBACK_LIMIT = 1024;
+
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        {
+            return static_cast<std::size_t>(FALLBACK_LIMIT / 2);
+        }
+
+        // the soft limit is often far below what the process is allowed to open
+        if (limit.rlim_cur != limit.rlim_max)
+        {
+            struct rlimit raised = { limit.rlim_max, limit.rlim_max };
+            if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+            {
+                limit = raised;
+            }
+        }
+
+        auto soft_limit = limit.rlim_cur == RLIM_INFINITY ? std::numeric_limits<int>::max() : limit.rlim_cur;
+        return static_cast<std::size_t>(std::max<rlim_t>(soft_limit / 2, 1));
+    }());
+    return budget;
+}
+
+int open_descriptor(const fs::path& path, int flags)
+{
+    try
+    {
+        return retry_exhausted_descriptors([&]() {
+            int fd = open(path.c_str(), flags);
+            if (fd < 0 && (errno == EMFILE || errno == ENFILE))
+            {
+                throw fs::filesystem_error("could not open", path, std::error_code(errno, std::generic_category()));
+            }
+            return fd;
+        });
+    }
+    catch(const fs::filesystem_error& e)
+    {
+        errno = e.code().value();
+        return -1;
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef FD_BUDGET_HPP
+#define FD_BUDGET_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <semaphore>
+
+// caps the file descriptors the traversal holds open at once, so that many workers walking and reading
+// at the same time leave room for everything else the process opens. the budget is half of the soft
+// limit on open files, which is raised to the hard limit first.
+class FdBudget
+{
+    public:
+        static FdBudget& shared();
+
+        // holds one descriptor of the budget for as long as it lives
+        class Lease
+        {
+            public:
+                Lease(FdBudget& budget) : m_budget(budget) { m_budget.m_available.acquire(); };
+                ~Lease() { m_budget.release(); };
+
+                Lease(const Lease&) = delete;
+                Lease& operator=(const Lease&) = delete;
+
+            private:
+                FdBudget& m_budget;
+        };
+
+        Lease lease() { return Lease(*this); };
+
+        std::size_t size() const { return m_size; };
+
+        // blocks until a lease is released or timeout has passed. descriptors held outside of the budget
+        // are closed without a notice, which is what the timeout is for.
+        void wait_for_release(std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(m_released_mutex);
+            m_n_waiting++;
+            m_released.wait_for(lock, timeout);
+            m_n_waiting--;
+        }
+
+    private:
+        FdBudget(std::size_t size) : m_size(size), m_available(size) {};
+
+        // only wakes waiters when there are any, so that releasing a lease stays cheap otherwise
+        void release()
+        {
+            m_available.release();
+            if (m_n_waiting.load())
+            {
+                std::lock_guard<std::mutex> guard(m_released_mutex);
+                m_released.notify_all();
+            }
+        }
+
+    private:
+        std::size_t m_size;
+        std::counting_semaphore<> m_available;
+
+        std::mutex m_released_mutex;
+        std::condition_variable m_released;
+        std::atomic<std::size_t> m_n_waiting = 0;
+};
+
+// runs open, retrying while it fails because the process or the system ran out of file descriptors.
+// every retry waits for a descriptor of the budget to be released, or for a growing delay. descriptors
+// are closed again eventually, and giving up would silently lose results that can be read a moment later,
+// so it never gives up.
+template<typename Open>
+auto retry_exhausted_descriptors(Open open) -> decltype(open())
+{
+    constexpr auto MAX_DELAY = std::chrono::milliseconds(100);
+
+    auto delay = std::chrono::milliseconds(1);
+    while (true)
+    {
+        try
+        {
+            return open();
+        }
+        catch(const std::filesystem::filesystem_error& e)
+        {
+            auto error = e.code().value();
+            if (error != EMFILE && error != ENFILE)
+            {
+                throw;
+            }
+        }
+
+        FdBudget::shared().wait_for_release(delay);
+        delay = std::min(delay * 2, MAX_DELAY);
+    }
+}
+
+// open(2) that waits out a shortage of file descriptors like retry_exhausted_descriptors(), and fails
+// like open(2) otherwise
+int open_descriptor(const std::filesystem::path& path, int flags);
+
+#endif
@@ -0,0 +1,235 @@
+#include "hash.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fd_budget.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr std::uint64_t PRIME_1 = 11400714785074694791ULL;
+    constexpr std::uint64_t PRIME_2 = 14029467366897019727ULL;
+    constexpr std::uint64_t PRIME_3 = 1609587929392839161ULL;
+    constexpr std::uint64_t PRIME_4 = 9650029242287828579ULL;
+    constexpr std::uint64_t PRIME_5 = 2870177450012600261ULL;
+
+    std::uint64_t read_u64(const unsigned char* data)
+    {
+        std::uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    std::uint32_t read_u32(const unsigned char* data)
+    {
+        std::uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    std::uint64_t round(std::uint64_t accumulator, std::uint64_t input)
+    {
+        accumulator += input * PRIME_2;
+        return std::rotl(accumulator, 31) * PRIME_1;
+    }
+
+    std::uint64_t merge_round(std::uint64_t accumulator, std::uint64_t value)
+    {
+        accumulator ^= round(0, value);
+        return accumulator * PRIME_1 + PRIME_4;
+    }
+
+    class File
+    {
+        public:
+            File(const fs::path& path)
+                : m_lease(FdBudget::shared().lease()), m_path(path), m_fd(open_descriptor(path, O_RDONLY | O_CLOEXEC))
+            {
+                if (m_fd < 0)
+                {
+                    fail();
+                }
+            };
+            ~File() { close(m_fd); };
+
+            std::size_t read_at(unsigned char* data, std::size_t size, std::uint64_t offset)
+            {
+                std::size_t total = 0;
+                while (total < size)
+                {
+                    auto n_read = pread(m_fd, data + total, size - total, offset + total);
+                    if (n_read < 0)
+                    {
+                        fail();
+                    }
+                    if (n_read == 0)
+                    {
+                        break;
+                    }
+                    total += n_read;
+                }
+                return total;
+            }
+
+        private:
+            [[noreturn]] void fail()
+            {
+                throw fs::filesystem_error("could not read", m_path, std::error_code(errno, std::generic_category()));
+            }
+
+        private:
+            FdBudget::Lease m_lease;
+            const fs::path& m_path;
+            int m_fd;
+    };
+}
+
+Hasher::Hasher(std::uint64_t seed) : m_buffered(0), m_total(0), m_seed(seed)
+{
+    m_accumulators = { seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1 };
+}
+
+void Hasher::update(const void* data, std::size_t size)
+{
+    auto input = static_cast<const unsigned char*>(data);
+    m_total += size;
+
+    if (m_buffered + size < m_buffer.size())
+    {
+        std::memcpy(m_buffer.data() + m_buffered, input, size);
+        m_buffered += size;
+        return;
+    }
+
+    if (m_buffered)
+    {
+        auto fill = m_buffer.size() - m_buffered;
+        std::memcpy(m_buffer.data() + m_buffered, input, fill);
+        for (std::size_t lane = 0; lane < 4; lane++)
+        {
+            m_accumulators[lane] = round(m_accumulators[lane], read_u64(m_buffer.data() + lane * 8));
+        }
+        input += fill;
+        size -= fill;
+        m_buffered = 0;
+    }
+
+    for (; size >= 32; input += 32, size -= 32)
+    {
+        for (std::size_t lane = 0; lane < 4; lane++)
+        {
+            m_accumulators[lane] = round(m_accumulators[lane], read_u64(input + lane * 8));
+        }
+    }
+
+    std::memcpy(m_buffer.data(), input, size);
+    m_buffered = size;
+}
+
+std::uint64_t Hasher::digest() const
+{
+    std::uint64_t hash;
+    if (m_total >= 32)
+    {
+        auto& [v1, v2, v3, v4] = m_accumulators;
+        hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        for (auto accumulator : m_accumulators)
+        {
+            hash = merge_round(hash, accumulator);
+        }
+    }
+    else
+    {
+        hash = m_seed + PRIME_5;
+    }
+    hash += m_total;
+
+    auto remaining = m_buffer.data();
+    auto end = m_buffer.data() + m_buffered;
+    for (; remaining + 8 <= end; remaining += 8)
+    {
+        hash ^= round(0, read_u64(remaining));
+        hash = std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    if (remaining + 4 <= end)
+    {
+        hash ^= static_cast<std::uint64_t>(read_u32(remaining)) * PRIME_1;
+        hash = std::rotl(hash, 23) * PRIME_2 + PRIME_3;
+        remaining += 4;
+    }
+    for (; remaining < end; remaining++)
+    {
+        hash ^= *remaining * PRIME_5;
+        hash = std::rotl(hash, 11) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+std::uint64_t hash_file_edges(const fs::path& path, std::uint64_t size, std::size_t edge_size)
+{
+    File file(path);
+    std::vector<unsigned char> buffer(2 * edge_size);
+
+    std::size_t n_read;
+    if (size <= buffer.size())
+    {
+        n_read = file.read_at(buffer.data(), buffer.size(), 0);
+    }
+    else
+    {
+        n_read = file.read_at(buffer.data(), edge_size, 0);
+        n_read += file.read_at(buffer.data() + n_read, edge_size, size - edge_size);
+    }
+
+    Hasher hasher;
+    hasher.update(buffer.data(), n_read);
+    return hasher.digest();
+}
+
+std::uint64_t hash_file(const fs::path& path)
+{
+    File file(path);
+    std::vector<unsigned char> buffer(1 << 20);
+
+    Hasher hasher;
+    std::uint64_t offset = 0;
+    for (std::size_t n_read; (n_read = file.read_at(buffer.data(), buffer.size(), offset)) > 0; offset += n_read)
+    {
+        hasher.update(buffer.data(), n_read);
+    }
+    return hasher.digest();
+}
+
+bool files_equal(const fs::path& lhs, const fs::path& rhs, std::uint64_t size)
+{
+    File lhs_file(lhs);
+    File rhs_file(rhs);
+    std::vector<unsigned char> lhs_buffer(std::clamp<std::uint64_t>(size, 1, 1 << 20));
+    std::vector<unsigned char> rhs_buffer(lhs_buffer.size());
+
+    for (std::uint64_t offset = 0;; offset += lhs_buffer.size())
+    {
+        auto n_read = lhs_file.read_at(lhs_buffer.data(), lhs_buffer.size(), offset);
+        if (rhs_file.read_at(rhs_buffer.data(), rhs_buffer.size(), offset) != n_read ||
+            std::memcmp(lhs_buffer.data(), rhs_buffer.data(), n_read) != 0)
+        {
+            return false;
+        }
+        if (n_read < lhs_buffer.size())
+        {
+            return true;
+        }
+    }
+}
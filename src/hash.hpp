@@ -0,0 +1,34 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+
+// streaming 64 bit xxHash (XXH64), a fast non-cryptographic digest
+class Hasher
+{
+    public:
+        Hasher(std::uint64_t seed = 0);
+
+        void update(const void* data, std::size_t size);
+        std::uint64_t digest() const;
+
+    private:
+        std::array<std::uint64_t, 4> m_accumulators;
+        std::array<unsigned char, 32> m_buffer;
+        std::size_t m_buffered;
+        std::uint64_t m_total;
+        std::uint64_t m_seed;
+};
+
+// digest of the first and the last edge_size bytes of a file, which covers the whole file when it is
+// at most twice as large as edge_size
+std::uint64_t hash_file_edges(const std::filesystem::path& path, std::uint64_t size, std::size_t edge_size);
+
+std::uint64_t hash_file(const std::filesystem::path& path);
+
+// whether two files of about the given size have the same contents, compared byte by byte
+bool files_equal(const std::filesystem::path& lhs, const std::filesystem::path& rhs, std::uint64_t size);
+
+#endif
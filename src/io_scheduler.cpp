@@ -0,0 +1,106 @@
+#include "io_scheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+#endif
+
+    std::chrono::nanoseconds transfer_time(std::uint64_t amount, std::uint64_t per_second)
+    {
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(1e9 * amount / per_second));
+    }
+}
+
+IoScheduler& IoScheduler::shared()
+{
+    static IoScheduler scheduler;
+    return scheduler;
+}
+
+void IoScheduler::configure(const IoLimits& limits)
+{
+    m_limits = limits;
+    m_limited = limits.m_concurrency || limits.m_bytes_per_second || limits.m_ops_per_second || limits.m_idle;
+}
+
+IoScheduler::DeviceQueue* IoScheduler::device_queue(std::uint64_t device)
+{
+    std::lock_guard<std::mutex> guard(m_devices_mutex);
+    auto& queue = m_devices[device];
+    if (!queue)
+    {
+        queue = std::make_unique<DeviceQueue>();
+    }
+    return queue.get();
+}
+
+IoScheduler::Admission::Admission(IoScheduler& scheduler, std::uint64_t device, std::uint64_t n_bytes)
+    : m_queue(scheduler.device_queue(device))
+{
+    const auto& limits = scheduler.m_limits;
+
+    std::unique_lock<std::mutex> lock(m_queue->m_mutex);
+    if (limits.m_concurrency)
+    {
+        m_queue->m_available.wait(lock, [&]() { return m_queue->m_in_flight < limits.m_concurrency; });
+    }
+    m_queue->m_in_flight++;
+
+    // every operation reserves its share of the rates up front and waits for its turn outside the lock
+    auto now = Clock::now();
+    auto start = now;
+    if (limits.m_ops_per_second)
+    {
+        start = std::max(start, m_queue->m_next_op);
+        m_queue->m_next_op = std::max(now, m_queue->m_next_op) + transfer_time(1, limits.m_ops_per_second);
+    }
+    if (limits.m_bytes_per_second && n_bytes)
+    {
+        start = std::max(start, m_queue->m_next_byte);
+        m_queue->m_next_byte = std::max(now, m_queue->m_next_byte) + transfer_time(n_bytes, limits.m_bytes_per_second);
+    }
+    lock.unlock();
+
+    std::this_thread::sleep_until(start);
+}
+
+IoScheduler::Admission::~Admission()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_queue->m_mutex);
+        m_queue->m_in_flight--;
+    }
+    m_queue->m_available.notify_one();
+}
+
+// the io priority of a thread is its own, so only the thread running the operation is affected
+IoScheduler::IdlePriority::IdlePriority(bool idle) : m_previous(-1)
+{
+#if defined(__linux__)
+    if (idle)
+    {
+        m_previous = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    }
+#endif
+}
+
+IoScheduler::IdlePriority::~IdlePriority()
+{
+#if defined(__linux__)
+    if (m_previous >= 0)
+    {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, m_previous);
+    }
+#endif
+}
@@ -0,0 +1,119 @@
+#ifndef IO_SCHEDULER_HPP
+#define IO_SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "metrics.hpp"
+
+// a limit of 0 is not enforced
+struct IoLimits
+{
+    std::size_t m_concurrency = 0;
+    std::uint64_t m_bytes_per_second = 0;
+    std::uint64_t m_ops_per_second = 0;
+
+    // runs disk operations in the idle i/o priority class, so they only get the disk when nobody else wants it
+    bool m_idle = false;
+};
+
+// paces disk operations per device. every device admits at most m_concurrency operations at a time and
+// delays operations to stay under its byte and operation rates, while devices never wait on each other.
+// a worker blocked on a busy device is the backpressure that keeps the traversal from running ahead.
+class IoScheduler
+{
+    public:
+        // process-wide scheduler shared by every runtime
+        static IoScheduler& shared();
+
+        // must be called before the first disk operation is run
+        void configure(const IoLimits& limits);
+
+        // runs io on the calling thread once the device can take an operation of n_bytes
+        template<typename Io>
+        void run(std::uint64_t device, std::uint64_t n_bytes, Io io)
+        {
+            run(device, device, n_bytes, io);
+        }
+
+        // runs io that reads from one device and writes to another once both of them can take it. devices
+        // are admitted in the order of their ids, so copies in opposite directions never wait on each other.
+        template<typename Io>
+        void run(std::uint64_t source_device, std::uint64_t destination_device, std::uint64_t n_bytes, Io io)
+        {
+            if (!m_limited)
+            {
+                io();
+            }
+            else
+            {
+                auto [first, second] = std::minmax(source_device, destination_device);
+                Admission first_admission(*this, first, n_bytes);
+                std::optional<Admission> second_admission;
+                if (second != first)
+                {
+                    second_admission.emplace(*this, second, n_bytes);
+                }
+
+                IdlePriority priority(m_limits.m_idle);
+                io();
+            }
+
+            Metrics::shared().add(Metrics::OPERATIONS);
+            Metrics::shared().add(Metrics::BYTES, n_bytes);
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct DeviceQueue
+        {
+            std::mutex m_mutex;
+            std::condition_variable m_available;
+            std::size_t m_in_flight = 0;
+
+            // earliest time at which the next operation or byte may go to the device
+            Clock::time_point m_next_op;
+            Clock::time_point m_next_byte;
+        };
+
+        // holds a slot of a device queue for as long as an operation runs
+        class Admission
+        {
+            public:
+                Admission(IoScheduler& scheduler, std::uint64_t device, std::uint64_t n_bytes);
+                ~Admission();
+
+            private:
+                DeviceQueue* m_queue;
+        };
+
+        // puts the calling thread in the idle i/o priority class for as long as an operation runs, so the
+        // rest of the work the thread does afterwards is not deprioritized with it
+        class IdlePriority
+        {
+            public:
+                IdlePriority(bool idle);
+                ~IdlePriority();
+
+            private:
+                int m_previous;
+        };
+
+        DeviceQueue* device_queue(std::uint64_t device);
+
+    private:
+        IoLimits m_limits;
+        bool m_limited = false;
+
+        std::mutex m_devices_mutex;
+        std::unordered_map<std::uint64_t, std::unique_ptr<DeviceQueue>> m_devices;
+};
+
+#endif
@@ -0,0 +1,412 @@
+#include "journal.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char MAGIC[8] = { 'F', 'S', 'Q', 'L', 'J', 'N', 'L', '\0' };
+    constexpr std::uint32_t VERSION = 2;
+
+    // a group is synced once this many bytes or this much time piled up since the last sync
+    constexpr std::size_t GROUP_SIZE = 256 * 1024;
+    constexpr std::chrono::milliseconds GROUP_INTERVAL(50);
+
+    // appenders only wait for the flusher when it falls this far behind
+    constexpr std::size_t MAX_BUFFERED = 16 * GROUP_SIZE;
+
+    template<typename T>
+    void put(std::string& buffer, T value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void put_string(std::string& buffer, std::string_view string)
+    {
+        put<std::uint32_t>(buffer, string.size());
+        buffer.append(string);
+    }
+
+    // reads the records of a journal back, failing once it runs past the end of the data
+    struct RecordReader
+    {
+        template<typename T>
+        bool get(T& value)
+        {
+            if (m_data.size() - m_offset < sizeof(value))
+            {
+                return false;
+            }
+            std::memcpy(&value, m_data.data() + m_offset, sizeof(value));
+            m_offset += sizeof(value);
+            return true;
+        }
+
+        bool get_string(std::string_view& string)
+        {
+            std::uint32_t size;
+            if (!get(size) || m_data.size() - m_offset < size)
+            {
+                return false;
+            }
+            string = m_data.substr(m_offset, size);
+            m_offset += size;
+            return true;
+        }
+
+        std::string_view m_data;
+        std::size_t m_offset;
+    };
+}
+
+Journal::Journal(const fs::path& path)
+    : m_path(path), m_next_section(0), m_appended(0), m_synced(0), m_sync_requested(0), m_stopping(false)
+{
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        throw fs::filesystem_error("could not open journal", path, std::error_code(errno, std::generic_category()));
+    }
+
+    try
+    {
+        load();
+    }
+    catch(...)
+    {
+        close(m_fd);
+        throw;
+    }
+
+    m_flusher = std::thread([this]() {
+        flush_groups();
+    });
+}
+
+Journal::~Journal()
+{
+    // the flusher writes the records of the last group before it stops. a failure there only means that
+    // a few steps are carried out once more by the next run.
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+    }
+    m_flush_condition.notify_one();
+    m_flusher.join();
+    close(m_fd);
+}
+
+void Journal::load()
+{
+    std::string data;
+    char chunk[64 * 1024];
+    for (ssize_t n_read; (n_read = read(m_fd, chunk, sizeof(chunk))) != 0;)
+    {
+        if (n_read < 0)
+        {
+            throw fs::filesystem_error("could not read journal", m_path, std::error_code(errno, std::generic_category()));
+        }
+        data.append(chunk, n_read);
+    }
+
+    if (data.empty())
+    {
+        std::string header(MAGIC, sizeof(MAGIC));
+        put(header, VERSION);
+        write(header);
+
+        // the journal has to survive a crash before the first group is synced, and so does its name
+        fdatasync(m_fd);
+        int directory_fd = open(fs::absolute(m_path).parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory_fd >= 0)
+        {
+            fsync(directory_fd);
+            close(directory_fd);
+        }
+        return;
+    }
+
+    std::uint32_t version;
+    RecordReader reader{ data, sizeof(MAGIC) };
+    if (data.size() < sizeof(MAGIC) || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0 || !reader.get(version) || version != VERSION)
+    {
+        throw std::runtime_error(std::format("runtime error: {} is not a valid journal", m_path.string()));
+    }
+
+    // a crash may have cut the last record short, in which case the journal ends with the record before it
+    std::size_t end = reader.m_offset;
+    while (true)
+    {
+        RecordType type;
+        std::uint32_t index;
+        if (!reader.get(type) || !reader.get(index) || index > m_sections.size())
+        {
+            break;
+        }
+
+        bool complete = true;
+        switch (type)
+        {
+        case RecordType::BEGIN:
+        {
+            InstrType kind;
+            std::string_view destination_path;
+            complete = reader.get(kind) && reader.get_string(destination_path);
+            if (complete)
+            {
+                // a section begins again when the run that planned it was interrupted before the plan was durable
+                auto section = std::make_unique<Section>(*this, index, kind, destination_path);
+                if (index == m_sections.size())
+                {
+                    m_sections.emplace_back(std::move(section));
+                }
+                else
+                {
+                    m_sections[index] = std::move(section);
+                }
+            }
+            break;
+        }
+        case RecordType::PLAN:
+        {
+            std::string_view source, destination;
+            Section::Identity identity;
+            complete = index < m_sections.size() && reader.get_string(source) && reader.get_string(destination) && reader.get(identity);
+            if (complete)
+            {
+                auto& section = *m_sections[index];
+                section.m_steps.emplace_back(Section::Step{ section.m_paths.intern(source).first, section.m_paths.intern(destination).first, identity });
+                section.m_done.emplace_back(false);
+            }
+            break;
+        }
+        case RecordType::PLANNED:
+            complete = index < m_sections.size();
+            if (complete)
+            {
+                m_sections[index]->m_planned = true;
+            }
+            break;
+        case RecordType::DONE:
+        {
+            std::uint64_t step;
+            complete = index < m_sections.size() && reader.get(step) && step < m_sections[index]->size();
+            if (complete)
+            {
+                m_sections[index]->m_done[step] = true;
+            }
+            break;
+        }
+        case RecordType::COMPLETED:
+            complete = index < m_sections.size();
+            if (complete)
+            {
+                m_sections[index]->m_completed = true;
+            }
+            break;
+        default:
+            complete = false;
+            break;
+        }
+
+        if (!complete)
+        {
+            break;
+        }
+        end = reader.m_offset;
+    }
+
+    if (end < data.size() && ftruncate(m_fd, end) != 0)
+    {
+        throw fs::filesystem_error("could not truncate journal", m_path, std::error_code(errno, std::generic_category()));
+    }
+}
+
+Journal::Section& Journal::next_section(InstrType kind, const fs::path& destination_path)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto index = m_next_section++;
+    if (index < m_sections.size())
+    {
+        auto& section = *m_sections[index];
+        if (section.m_kind != kind || section.m_destination_path != destination_path)
+        {
+            throw std::runtime_error(std::format("runtime error: journal {} was written by a different script", m_path.string()));
+        }
+
+        if (section.m_planned)
+        {
+            return section;
+        }
+    }
+
+    // an unfinished plan is discarded, nothing of it was carried out yet
+    auto section = std::make_unique<Section>(*this, index, kind, destination_path);
+    if (index < m_sections.size())
+    {
+        m_sections[index] = std::move(section);
+    }
+    else
+    {
+        m_sections.emplace_back(std::move(section));
+    }
+
+    std::string payload;
+    put(payload, kind);
+    put_string(payload, destination_path.native());
+    append(lock, RecordType::BEGIN, index, payload, false);
+    return *m_sections[index];
+}
+
+bool Journal::completed() const
+{
+    for (const auto& section : m_sections)
+    {
+        if (!section->m_completed)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Journal::append(std::unique_lock<std::mutex>& lock, RecordType type, std::uint32_t section, std::string_view payload, bool sync)
+{
+    m_synced_condition.wait(lock, [&]() { return m_error || m_buffer.size() < MAX_BUFFERED; });
+    if (m_error)
+    {
+        std::rethrow_exception(m_error);
+    }
+
+    put(m_buffer, type);
+    put(m_buffer, section);
+    m_buffer.append(payload);
+    auto sequence = ++m_appended;
+
+    if (sync)
+    {
+        m_sync_requested = sequence;
+        m_flush_condition.notify_one();
+        m_synced_condition.wait(lock, [&]() { return m_error || m_synced >= sequence; });
+        if (m_synced < sequence)
+        {
+            std::rethrow_exception(m_error);
+        }
+    }
+    else if (m_buffer.size() >= GROUP_SIZE)
+    {
+        m_flush_condition.notify_one();
+    }
+}
+
+void Journal::flush_groups()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_error)
+    {
+        m_flush_condition.wait_for(lock, GROUP_INTERVAL, [&]() {
+            return m_stopping || m_buffer.size() >= GROUP_SIZE || m_sync_requested > m_synced;
+        });
+        if (m_buffer.empty())
+        {
+            if (m_stopping)
+            {
+                return;
+            }
+            continue;
+        }
+
+        // records appended while the group is written go to the next one
+        std::string group;
+        group.swap(m_buffer);
+        auto group_end = m_appended;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            write(group);
+            if (fdatasync(m_fd) != 0)
+            {
+                throw fs::filesystem_error("could not sync journal", m_path, std::error_code(errno, std::generic_category()));
+            }
+        }
+        catch(...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error)
+        {
+            m_error = error;
+        }
+        else
+        {
+            m_synced = group_end;
+        }
+        m_synced_condition.notify_all();
+    }
+}
+
+void Journal::write(std::string_view data)
+{
+    while (!data.empty())
+    {
+        auto n_written = ::write(m_fd, data.data(), data.size());
+        if (n_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw fs::filesystem_error("could not write journal", m_path, std::error_code(errno, std::generic_category()));
+        }
+        data.remove_prefix(n_written);
+    }
+}
+
+void Journal::Section::plan(const fs::path& source, const fs::path& destination, const Metadata& metadata)
+{
+    Identity identity{ metadata.m_device, metadata.m_inode, metadata.m_size, metadata.m_modified };
+
+    std::string payload;
+    put_string(payload, source.native());
+    put_string(payload, destination.native());
+    put(payload, identity);
+
+    // steps are numbered in the order their records were appended, so both happen under the lock
+    std::unique_lock<std::mutex> lock(m_journal.m_mutex);
+    m_steps.emplace_back(Step{ m_paths.intern(source).first, m_paths.intern(destination).first, identity });
+    m_done.emplace_back(false);
+    m_journal.append(lock, RecordType::PLAN, m_index, payload, false);
+}
+
+void Journal::Section::finish_plan()
+{
+    std::unique_lock<std::mutex> lock(m_journal.m_mutex);
+    m_planned = true;
+    m_journal.append(lock, RecordType::PLANNED, m_index, {}, true);
+}
+
+void Journal::Section::mark_done(std::size_t step)
+{
+    std::string payload;
+    put<std::uint64_t>(payload, step);
+
+    std::unique_lock<std::mutex> lock(m_journal.m_mutex);
+    m_done[step] = true;
+    m_journal.append(lock, RecordType::DONE, m_index, payload, false);
+}
+
+void Journal::Section::complete()
+{
+    std::unique_lock<std::mutex> lock(m_journal.m_mutex);
+    m_completed = true;
+    m_journal.append(lock, RecordType::COMPLETED, m_index, {}, true);
+}
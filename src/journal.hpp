@@ -0,0 +1,144 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "entry.hpp"
+#include "path_arena.hpp"
+#include "runtime_types.hpp"
+
+// write-ahead journal of the disk operations of a script. every journaled operation records the steps
+// it plans to take (a source and the destination picked for it) and makes the plan durable before it
+// touches anything, then records each step once it has been carried out. a script that is run again
+// after being interrupted resumes every operation from the journal instead of walking the file system
+// and picking new destinations.
+//
+// records are appended to an in-memory buffer that a flusher thread writes with one fdatasync for all the
+// records that piled up in the meantime. workers that finish steps only hand their records over, and
+// only a record that has to be durable before the script goes on waits for its group to be synced.
+class Journal
+{
+    public:
+        // one disk operation of a script, matched to the operations of a later run by its position
+        class Section
+        {
+            public:
+                Section(Journal& journal, std::uint32_t index, InstrType kind, const std::filesystem::path& destination_path)
+                    : m_journal(journal), m_index(index), m_kind(kind), m_destination_path(destination_path), m_planned(false), m_completed(false) {};
+
+                bool planned() const { return m_planned; };
+                bool completed() const { return m_completed; };
+
+                std::size_t size() const { return m_steps.size(); };
+                bool done(std::size_t step) const { return m_done[step]; };
+
+                // what the source of a step was when the step was planned, so that a step resumed by a later
+                // run can tell whether its path still holds the same file
+                struct Identity
+                {
+                    std::uint64_t m_device;
+                    std::uint64_t m_inode;
+                    std::uint64_t m_size;
+                    std::int64_t m_modified;
+                };
+
+                std::filesystem::path source(std::size_t step) const { return m_paths.path(m_steps[step].m_source); };
+                std::filesystem::path destination(std::size_t step) const { return m_paths.path(m_steps[step].m_destination); };
+                const Identity& identity(std::size_t step) const { return m_steps[step].m_identity; };
+
+                // adds a step to the plan, which only becomes durable once the plan is finished
+                void plan(const std::filesystem::path& source, const std::filesystem::path& destination, const Metadata& metadata);
+                void finish_plan();
+
+                // steps are committed in groups, so the last few may be carried out once more after a crash
+                void mark_done(std::size_t step);
+                void complete();
+
+            private:
+                friend class Journal;
+
+                struct Step
+                {
+                    PathArena::Id m_source;
+                    PathArena::Id m_destination;
+                    Identity m_identity;
+                };
+
+                Journal& m_journal;
+                std::uint32_t m_index;
+                InstrType m_kind;
+                std::filesystem::path m_destination_path;
+
+                PathArena m_paths;
+                std::vector<Step> m_steps;
+                std::vector<std::uint8_t> m_done;
+                bool m_planned;
+                bool m_completed;
+        };
+
+        // opens the journal at path, creating it if it does not exist yet. throws std::runtime_error when
+        // the file is not a journal.
+        Journal(const std::filesystem::path& path);
+        ~Journal();
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        // the section of the next journaled operation of the script, as recorded by an earlier run if there
+        // was one. throws std::runtime_error when the earlier run recorded a different operation there.
+        Section& next_section(InstrType kind, const std::filesystem::path& destination_path);
+
+        // whether every operation the journal knows of has completed
+        bool completed() const;
+
+    private:
+        enum class RecordType : std::uint8_t
+        {
+            BEGIN,
+            PLAN,
+            PLANNED,
+            DONE,
+            COMPLETED,
+        };
+
+        void load();
+
+        // appends a record for the section, and waits for it to be durable when sync is set. the record is
+        // written with the next group otherwise, which is due once enough records or time piled up.
+        void append(std::unique_lock<std::mutex>& lock, RecordType type, std::uint32_t section, std::string_view payload, bool sync);
+        void write(std::string_view data);
+
+        // body of the flusher thread, which writes and syncs groups until the journal is closed
+        void flush_groups();
+
+    private:
+        std::filesystem::path m_path;
+        int m_fd;
+
+        std::vector<std::unique_ptr<Section>> m_sections;
+        std::size_t m_next_section;
+
+        std::mutex m_mutex;
+        std::condition_variable m_flush_condition;
+        std::condition_variable m_synced_condition;
+        std::string m_buffer;
+        std::uint64_t m_appended;
+        std::uint64_t m_synced;
+
+        // the last record somebody waits on to be durable
+        std::uint64_t m_sync_requested;
+        bool m_stopping;
+        std::exception_ptr m_error;
+        std::thread m_flusher;
+};
+
+#endif
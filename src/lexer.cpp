@@ -13,29 +13,86 @@ namespace lexer
         {"directories", TokenType::DIRECTORIES},
         {"all", TokenType::ALL},
         {"recursive", TokenType::RECURSIVE},
+        {"duplicates", TokenType::DUPLICATES},
         {"move", TokenType::MOVE},
         {"copy", TokenType::COPY},
         {"delete", TokenType::DELETE},
         {"display", TokenType::DISPLAY},
+        {"save", TokenType::SAVE},
+        {"sync", TokenType::SYNC},
+        {"checksum", TokenType::CHECKSUM},
+        {"dry", TokenType::DRY},
+        {"manifest", TokenType::MANIFEST},
+        {"stdin", TokenType::STDIN},
+        {"count", TokenType::COUNT},
+        {"sum", TokenType::SUM},
+        {"min", TokenType::MIN},
+        {"max", TokenType::MAX},
+        {"group", TokenType::GROUP},
+        {"by", TokenType::BY},
+        {"directory", TokenType::DIRECTORY},
+        {"order", TokenType::ORDER},
+        {"asc", TokenType::ASC},
+        {"desc", TokenType::DESC},
+        {"limit", TokenType::LIMIT},
+        {"exclude", TokenType::EXCLUDE},
+        {"depth", TokenType::DEPTH},
+        {"follow", TokenType::FOLLOW},
+        {"symlinks", TokenType::SYMLINKS},
+        {"approx", TokenType::APPROX},
+        {"within", TokenType::WITHIN},
+        {"for", TokenType::FOR},
         {"extension", TokenType::EXTENSION},
         {"size", TokenType::SIZE},
+        {"contains", TokenType::CONTAINS},
+        {"name", TokenType::NAME},
+        {"like", TokenType::LIKE},
+        {"matches", TokenType::MATCHES},
+        {"modified", TokenType::MODIFIED},
+        {"accessed", TokenType::ACCESSED},
+        {"created", TokenType::CREATED},
         {"and", TokenType::AND},
         {"or", TokenType::OR},
         {"B", TokenType::B},
         {"KB", TokenType::KB},
         {"MB", TokenType::MB},
-        {"GB", TokenType::GB}
+        {"GB", TokenType::GB},
+        {"s", TokenType::SECONDS},
+        {"m", TokenType::MINUTES},
+        {"h", TokenType::HOURS},
+        {"d", TokenType::DAYS},
+        {"w", TokenType::WEEKS}
     };
 
     void handle_string(std::istream& is, std::string& lexeme)
     {
+        // read unformatted so that whitespace inside of strings is kept
         char ch{};
-        while ((is >> ch) && ch != '\"')
+        while (is.get(ch) && ch != '\"')
         {
             lexeme += ch;
         }
     }
 
+    // regular expressions are delimited by slashes, where an escaped slash stands for a literal one
+    void handle_regex(std::istream& is, std::string& lexeme)
+    {
+        char ch{};
+        while (is.get(ch) && ch != '/')
+        {
+            if (ch == '\\' && is.peek() == '/')
+            {
+                is.get(ch);
+            }
+            else if (ch == '\\' && is.peek() != EOF)
+            {
+                lexeme += ch;
+                is.get(ch);
+            }
+            lexeme += ch;
+        }
+    }
+
     void generate_tokens(std::istream& is, std::vector<Token>& tokens) 
     {
         char ch{};
@@ -50,6 +107,10 @@ namespace lexer
                 handle_string(is, new_token.m_lexeme);
                 new_token.m_type = TokenType::STRING;
                 break;
+            case '/':
+                handle_regex(is, new_token.m_lexeme);
+                new_token.m_type = TokenType::REGEX;
+                break;
             case '<':
                 new_token.m_lexeme = ch;
                 new_token.m_type = TokenType::LTHAN;
@@ -78,6 +139,10 @@ namespace lexer
                 new_token.m_lexeme = ch;
                 new_token.m_type = TokenType::COMMA;
                 break;
+            case '%':
+                new_token.m_lexeme = ch;
+                new_token.m_type = TokenType::PERCENT;
+                break;
             default:
                 if (isalpha(ch)) 
                 {
@@ -102,6 +167,20 @@ namespace lexer
                         new_token.m_lexeme += ch;
                     } while (isnumber(is.peek()) && (is >> ch));
                     new_token.m_type = TokenType::NUMBER;
+
+                    if (is.peek() == '.')
+                    {
+                        new_token.m_lexeme += static_cast<char>(is.get());
+                        if (!isnumber(is.peek()))
+                        {
+                            throw std::runtime_error(std::format("invalid token: {}", new_token.m_lexeme));
+                        }
+                        while (isnumber(is.peek()) && (is >> ch))
+                        {
+                            new_token.m_lexeme += ch;
+                        }
+                        new_token.m_type = TokenType::DECIMAL;
+                    }
                 }
                 else 
                 {
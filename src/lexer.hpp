@@ -13,23 +13,61 @@ namespace lexer
         DIRECTORIES,
         ALL,
         RECURSIVE,
+        DUPLICATES,
 
         MOVE,
         COPY,
         DELETE,
         DISPLAY,
+        SAVE,
+        SYNC,
+        CHECKSUM,
+        DRY,
+        MANIFEST,
+        STDIN,
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+        GROUP,
+        BY,
+        DIRECTORY,
+        ORDER,
+        ASC,
+        DESC,
+        LIMIT,
+        EXCLUDE,
+        DEPTH,
+        FOLLOW,
+        SYMLINKS,
+        APPROX,
+        WITHIN,
+        FOR,
 
         WHERE,
         AND,
         OR,
         EXTENSION,
         SIZE,
+        CONTAINS,
+        NAME,
+        LIKE,
+        MATCHES,
+        MODIFIED,
+        ACCESSED,
+        CREATED,
 
         B,
         KB,
         MB,
         GB,
 
+        SECONDS,
+        MINUTES,
+        HOURS,
+        DAYS,
+        WEEKS,
+
         LTHAN,
         GTHAN,
         LPAREN,
@@ -37,10 +75,15 @@ namespace lexer
         COMMA,
         SEMICOL,
         EQ,
+        PERCENT,
 
         STRING,
+        REGEX,
         NUMBER,
 
+        // a number with a fractional part, which only some clauses accept
+        DECIMAL,
+
         DONE
     };
 
@@ -1,11 +1,20 @@
 #include <iostream>
+#include <sstream>
+#include <format>
+#include <optional>
+#include <vector>
+#include <unistd.h>
 
+#include "io_scheduler.hpp"
+#include "journal.hpp"
+#include "metrics.hpp"
 #include "parser.hpp"
 #include "runtime.hpp"
+#include "server.hpp"
 
 const char* program = "FSQL 0.0.0";
 
-int run(std::istream& stream) 
+int run(std::istream& stream, Runtime& runtime)
 {
     try
     {
@@ -14,7 +23,6 @@ int run(std::istream& stream)
         auto ast = parser.build_ast();
         ast->prune_conflicting_select();
 
-        Runtime runtime;
         runtime.run(ast->compile());
         return EXIT_SUCCESS;
     }
@@ -25,12 +33,275 @@ int run(std::istream& stream)
     }
 }
 
+// a statement is complete once it ends with a semicolon that is not inside a string or a regular
+// expression, which are delimited the way the lexer reads them: a backslash escapes the next character
+// of a regular expression, while strings have no escapes
+bool complete_statement(const std::string& statement)
+{
+    // the delimiter of the string or regular expression the statement is inside of, if any
+    char delimiter = '\0';
+    char last = '\0';
+    for (std::size_t i = 0; i < statement.size(); i++)
+    {
+        char ch = statement[i];
+        if (delimiter == '/' && ch == '\\')
+        {
+            i++;
+            continue;
+        }
+
+        if (delimiter != '\0')
+        {
+            delimiter = ch == delimiter ? '\0' : delimiter;
+        }
+        else if (ch == '\"' || ch == '/')
+        {
+            delimiter = ch;
+        }
+        if (!isspace(ch))
+        {
+            last = ch;
+        }
+    }
+    return delimiter == '\0' && last == ';';
+}
+
+void print_cache_stats(MetadataCache& cache)
+{
+    auto lookups = cache.hits() + cache.misses();
+    std::cerr << std::format("cache: {} entries, {} hits, {} misses ({:.1f}% hit rate)\n", cache.size(), cache.hits(),
+        cache.misses(), lookups ? 100.0 * cache.hits() / lookups : 0.0);
+}
+
+int interactive_shell(std::istream* paths_input)
+{
+    MetadataCache cache;
+    Runtime runtime(&cache, std::cout, paths_input);
+
+    bool interactive = isatty(STDIN_FILENO);
+    if (interactive)
+    {
+        std::cout << program << "\n" << "enter queries terminated by ';', .stats for cache statistics or .exit to quit\n";
+    }
+
+    std::string statement, line;
+    while (true)
+    {
+        if (interactive)
+        {
+            std::cout << (statement.empty() ? "fsql> " : "  ... ") << std::flush;
+        }
+        if (!std::getline(std::cin, line))
+        {
+            break;
+        }
+
+        if (statement.empty() && line.starts_with('.'))
+        {
+            if (line == ".exit" || line == ".quit")
+            {
+                break;
+            }
+            else if (line == ".stats")
+            {
+                print_cache_stats(cache);
+            }
+            else
+            {
+                std::cerr << "unknown command: " << line << "\n";
+            }
+            continue;
+        }
+
+        statement += line + '\n';
+        if (complete_statement(statement))
+        {
+            auto hits = cache.hits(), misses = cache.misses();
+
+            std::istringstream stream(statement);
+            run(stream, runtime);
+            statement.clear();
+
+            if (interactive)
+            {
+                hits = cache.hits() - hits;
+                misses = cache.misses() - misses;
+                if (hits + misses)
+                {
+                    std::cerr << std::format("({} directories listed, {} from cache, {:.1f}% hit rate)\n", hits + misses,
+                        hits, 100.0 * hits / (hits + misses));
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int serve(const char* socket_path)
+{
+    try
+    {
+        Server server(socket_path);
+        server.serve();
+        return EXIT_SUCCESS;
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}
+
+int connect_to_server(const char* socket_path, const char* source_path)
+{
+    try
+    {
+        if (!source_path)
+        {
+            return run_client(socket_path, std::cin);
+        }
+
+        std::ifstream source_file(source_path);
+        if (source_file.fail())
+        {
+            std::cout << "failed to open: " << source_path << "\n";
+            return EXIT_FAILURE;
+        }
+        return run_client(socket_path, source_file);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}
+
+struct Options
+{
+    IoLimits m_io_limits;
+
+    // file the stdin element reads paths from instead of standard input
+    const char* m_paths_from = nullptr;
+
+    // write-ahead journal of the disk operations of a source file, which resumes them when it is run again
+    const char* m_journal = nullptr;
+
+    // report progress on standard error, and metrics to a Prometheus text file
+    bool m_progress = false;
+    const char* m_metrics = nullptr;
+};
+
+// consumes the options, which may come before any other argument
+std::vector<char*> parse_options(int argc, char* argv[], Options& options)
+{
+    std::vector<char*> arguments = { argv[0] };
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view option = argv[i];
+        if (option == "--io-idle")
+        {
+            options.m_io_limits.m_idle = true;
+        }
+        else if (option == "--progress")
+        {
+            options.m_progress = true;
+        }
+        else if (option == "--paths-from" || option == "--journal" || option == "--metrics")
+        {
+            if (i + 1 == argc)
+            {
+                throw std::runtime_error(std::format("expected a file after {}", option));
+            }
+            (option == "--journal" ? options.m_journal : option == "--metrics" ? options.m_metrics : options.m_paths_from) = argv[++i];
+        }
+        else if (option == "--io-concurrency" || option == "--io-bps" || option == "--io-ops")
+        {
+            std::uint64_t value;
+            try
+            {
+                value = std::stoull(i + 1 < argc ? argv[++i] : "");
+            }
+            catch(const std::logic_error& e)
+            {
+                throw std::runtime_error(std::format("expected a number after {}", option));
+            }
+
+            if (option == "--io-concurrency")
+            {
+                options.m_io_limits.m_concurrency = value;
+            }
+            else if (option == "--io-bps")
+            {
+                options.m_io_limits.m_bytes_per_second = value;
+            }
+            else
+            {
+                options.m_io_limits.m_ops_per_second = value;
+            }
+        }
+        else
+        {
+            arguments.emplace_back(argv[i]);
+        }
+    }
+    return arguments;
+}
+
 int main(int argc, char* argv[])
 {
+    Options options;
+    std::vector<char*> arguments;
+    try
+    {
+        arguments = parse_options(argc, argv, options);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "invalid option: " << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+    IoScheduler::shared().configure(options.m_io_limits);
+
+    // reports until main returns, and once more at the end
+    std::optional<MetricsReporter> reporter;
+    if (options.m_progress || options.m_metrics)
+    {
+        reporter.emplace(options.m_progress, options.m_metrics ? std::optional<std::filesystem::path>(options.m_metrics) : std::nullopt);
+    }
+
+    argc = arguments.size();
+    argv = arguments.data();
+
+    std::ifstream paths_file;
+    if (options.m_paths_from)
+    {
+        paths_file.open(options.m_paths_from, std::ios::binary);
+        if (paths_file.fail())
+        {
+            std::cout << "failed to open: " << options.m_paths_from << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.m_journal && (argc < 2 || std::string_view(argv[1]) == "--serve" || std::string_view(argv[1]) == "--connect"))
+    {
+        std::cerr << "invalid option: --journal can only be used with a source file\n";
+        return EXIT_FAILURE;
+    }
+
     if (argc < 2)
     {
-        // TODO: interactive shell?
-        exit(1);
+        // standard input holds the statements of the shell, so paths can only come from a file
+        return interactive_shell(options.m_paths_from ? &paths_file : nullptr);
+    }
+    else if (std::string_view(argv[1]) == "--serve" || std::string_view(argv[1]) == "--connect")
+    {
+        if (argc < 3)
+        {
+            std::cerr << "usage: fsql [io options] --serve <socket> | fsql --connect <socket> [source_file]\n";
+            return EXIT_FAILURE;
+        }
+        return std::string_view(argv[1]) == "--serve" ? serve(argv[2]) : connect_to_server(argv[2], argc > 3 ? argv[3] : nullptr);
     }
     else
     {
@@ -40,7 +311,31 @@ int main(int argc, char* argv[])
             std::cout << "failed to open: " << argv[1] << "\n";
             return EXIT_FAILURE;
         }
-        return run(source_file);
+
+        std::optional<Journal> journal;
+        try
+        {
+            if (options.m_journal)
+            {
+                journal.emplace(options.m_journal);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+            return EXIT_FAILURE;
+        }
+
+        Runtime runtime(nullptr, std::cout, options.m_paths_from ? &paths_file : &std::cin, journal ? &*journal : nullptr);
+        auto status = run(source_file, runtime);
+
+        // a journal is only kept for as long as there is something left to resume
+        if (journal && status == EXIT_SUCCESS && journal->completed())
+        {
+            journal.reset();
+            std::filesystem::remove(options.m_journal);
+        }
+        return status;
     }
     return EXIT_SUCCESS;
 }
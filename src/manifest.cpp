@@ -0,0 +1,169 @@
+#include "manifest.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <format>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char MAGIC[8] = { 'F', 'S', 'Q', 'L', 'M', 'A', 'N', '\0' };
+    constexpr std::uint32_t VERSION = 1;
+
+    [[noreturn]] void invalid_manifest(const fs::path& path)
+    {
+        throw std::runtime_error(std::format("runtime error: {} is not a valid manifest", path.string()));
+    }
+}
+
+void manifest::write(const fs::path& path, const std::vector<std::pair<fs::path, Metadata>>& entries)
+{
+    Header header{};
+    std::memcpy(header.m_magic, MAGIC, sizeof(MAGIC));
+    header.m_version = VERSION;
+    header.m_record_size = sizeof(Record);
+    header.m_n_records = entries.size();
+
+    std::vector<Record> records;
+    records.reserve(entries.size());
+    for (const auto& [entry_path, metadata] : entries)
+    {
+        Record record{};
+        record.m_path_offset = header.m_paths_size;
+        record.m_path_size = entry_path.native().size();
+        record.m_type = static_cast<std::uint8_t>(metadata.m_type);
+        record.m_has_created = metadata.m_has_created;
+        record.m_size = metadata.m_size;
+        record.m_device = metadata.m_device;
+        record.m_inode = metadata.m_inode;
+        record.m_modified = metadata.m_modified;
+        record.m_accessed = metadata.m_accessed;
+        record.m_created = metadata.m_created;
+        records.emplace_back(record);
+
+        header.m_paths_size += record.m_path_size;
+    }
+
+    // the temporary file is unique, so saves of the same manifest running at once do not write into each
+    // other, and it is on disk before it replaces the manifest, so a crash leaves the old or the new one
+    static std::atomic<std::uint64_t> n_saves = 0;
+    auto temporary_path = fs::path(path).concat(std::format(".{}.{}.tmp", getpid(), n_saves.fetch_add(1)));
+    int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        throw fs::filesystem_error("could not create manifest", path, std::error_code(errno, std::generic_category()));
+    }
+
+    auto write_all = [fd](const void* data, std::size_t size) {
+        for (auto bytes = static_cast<const char*>(data); size;)
+        {
+            auto written = ::write(fd, bytes, size);
+            if (written < 0 && errno != EINTR)
+            {
+                return false;
+            }
+            if (written > 0)
+            {
+                bytes += written;
+                size -= written;
+            }
+        }
+        return true;
+    };
+
+    std::string paths;
+    paths.reserve(header.m_paths_size);
+    for (const auto& [entry_path, metadata] : entries)
+    {
+        paths += entry_path.native();
+    }
+
+    bool written = write_all(&header, sizeof(header)) && write_all(records.data(), records.size() * sizeof(Record)) &&
+        write_all(paths.data(), paths.size()) && fsync(fd) == 0;
+    close(fd);
+
+    if (!written || rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporary_path.c_str());
+        throw std::runtime_error(std::format("runtime error: could not write manifest {}", path.string()));
+    }
+}
+
+manifest::Reader::Reader(const fs::path& path) : m_data(nullptr), m_size(0)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw fs::filesystem_error("could not open manifest", path, std::error_code(errno, std::generic_category()));
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(Header))
+    {
+        close(fd);
+        invalid_manifest(path);
+    }
+
+    m_size = status.st_size;
+    m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m_data == MAP_FAILED)
+    {
+        throw fs::filesystem_error("could not map manifest", path, std::error_code(errno, std::generic_category()));
+    }
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+    // everything the records point at has to lie inside the file
+    m_header = static_cast<const Header*>(m_data);
+    m_records = reinterpret_cast<const Record*>(m_header + 1);
+    m_paths = reinterpret_cast<const char*>(m_records + m_header->m_n_records);
+
+    auto available = m_size - sizeof(Header);
+    if (std::memcmp(m_header->m_magic, MAGIC, sizeof(MAGIC)) || m_header->m_version != VERSION ||
+        m_header->m_record_size != sizeof(Record) || m_header->m_n_records > available / sizeof(Record) ||
+        m_header->m_paths_size != available - m_header->m_n_records * sizeof(Record))
+    {
+        munmap(m_data, m_size);
+        invalid_manifest(path);
+    }
+
+    for (std::size_t i = 0; i < size(); i++)
+    {
+        const auto& record = m_records[i];
+        if (record.m_path_offset > m_header->m_paths_size || record.m_path_size > m_header->m_paths_size - record.m_path_offset)
+        {
+            munmap(m_data, m_size);
+            invalid_manifest(path);
+        }
+    }
+}
+
+manifest::Reader::~Reader()
+{
+    munmap(m_data, m_size);
+}
+
+std::string_view manifest::Reader::path(std::size_t index) const
+{
+    return std::string_view(m_paths + m_records[index].m_path_offset, m_records[index].m_path_size);
+}
+
+Metadata manifest::Reader::metadata(std::size_t index) const
+{
+    const auto& record = m_records[index];
+    return Metadata{
+        static_cast<fs::file_type>(record.m_type),
+        record.m_size,
+        record.m_device,
+        record.m_inode,
+        record.m_modified,
+        record.m_accessed,
+        record.m_created,
+        record.m_has_created != 0
+    };
+}
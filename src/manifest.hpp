@@ -0,0 +1,68 @@
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+#include "entry.hpp"
+
+// a manifest is a binary file of entries with the metadata they had when they were saved. it holds a
+// header, a table of fixed size records and the concatenated paths they point into, all in native
+// byte order, so that it can be mapped and read in place without parsing.
+namespace manifest
+{
+    struct Header
+    {
+        char m_magic[8];
+        std::uint32_t m_version;
+        std::uint32_t m_record_size;
+        std::uint64_t m_n_records;
+        std::uint64_t m_paths_size;
+    };
+
+    struct Record
+    {
+        std::uint64_t m_path_offset;
+        std::uint32_t m_path_size;
+        std::uint8_t m_type;
+        std::uint8_t m_has_created;
+        std::uint16_t m_reserved;
+        std::uint64_t m_size;
+        std::uint64_t m_device;
+        std::uint64_t m_inode;
+        std::int64_t m_modified;
+        std::int64_t m_accessed;
+        std::int64_t m_created;
+    };
+
+    // writes the entries to path through a temporary file, so that an existing manifest is replaced at once
+    void write(const std::filesystem::path& path, const std::vector<std::pair<std::filesystem::path, Metadata>>& entries);
+
+    // read only mapping of a manifest, throws std::runtime_error when the file is not a valid manifest
+    class Reader
+    {
+        public:
+            Reader(const std::filesystem::path& path);
+            ~Reader();
+
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+
+            std::size_t size() const { return m_header->m_n_records; };
+
+            std::string_view path(std::size_t index) const;
+            Metadata metadata(std::size_t index) const;
+
+        private:
+            void* m_data;
+            std::size_t m_size;
+
+            const Header* m_header;
+            const Record* m_records;
+            const char* m_paths;
+    };
+}
+
+#endif
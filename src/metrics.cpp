@@ -0,0 +1,166 @@
+#include "metrics.hpp"
+
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // a terminal is redrawn often, a log only gets a line every now and then
+    constexpr auto INTERACTIVE_PROGRESS_INTERVAL = std::chrono::milliseconds(500);
+    constexpr auto PROGRESS_INTERVAL = std::chrono::seconds(10);
+    constexpr auto METRICS_INTERVAL = std::chrono::seconds(5);
+
+    std::string format_bytes(std::uint64_t n_bytes)
+    {
+        constexpr const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+
+        double size = n_bytes;
+        std::size_t unit = 0;
+        for (; size >= 1024 && unit + 1 < std::size(units); unit++)
+        {
+            size /= 1024;
+        }
+        return unit ? std::format("{:.1f} {}", size, units[unit]) : std::format("{} B", n_bytes);
+    }
+}
+
+Metrics& Metrics::shared()
+{
+    static Metrics metrics(ThreadPool::shared().size());
+    return metrics;
+}
+
+Metrics::Totals Metrics::totals() const
+{
+    Totals totals{};
+    for (std::size_t i = 0; i <= m_n_workers; i++)
+    {
+        for (std::size_t counter = 0; counter < N_COUNTERS; counter++)
+        {
+            totals[counter] += m_slots[i].m_counts[counter].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+MetricsReporter::MetricsReporter(bool progress, std::optional<fs::path> metrics_path)
+    : m_progress(progress), m_interactive(isatty(STDERR_FILENO)), m_metrics_path(std::move(metrics_path)),
+    m_started(Clock::now()), m_last_report(m_started), m_last_progress(m_started), m_last_write(m_started),
+    m_last_operations(Metrics::shared().totals()[Metrics::OPERATIONS]), m_stopped(false)
+{
+    auto interval = m_interactive ? INTERACTIVE_PROGRESS_INTERVAL : PROGRESS_INTERVAL;
+    auto tick = m_progress ? std::min<Clock::duration>(interval, METRICS_INTERVAL) : METRICS_INTERVAL;
+    m_thread = std::thread([this, tick]() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopped_condition.wait_for(lock, tick, [this]() { return m_stopped; }))
+        {
+            report(false);
+        }
+    });
+}
+
+MetricsReporter::~MetricsReporter()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopped = true;
+    }
+    m_stopped_condition.notify_all();
+    m_thread.join();
+    report(true);
+}
+
+void MetricsReporter::report(bool last)
+{
+    auto now = Clock::now();
+    auto totals = Metrics::shared().totals();
+
+    // the operation rate is taken over the time since the last report
+    auto elapsed = std::chrono::duration<double>(now - m_last_report).count();
+    auto operations = totals[Metrics::OPERATIONS];
+    double ops_per_second = elapsed > 0 ? (operations - m_last_operations) / elapsed : 0;
+    m_last_report = now;
+    m_last_operations = operations;
+
+    auto interval = m_interactive ? INTERACTIVE_PROGRESS_INTERVAL : PROGRESS_INTERVAL;
+    if (m_progress && (last || now - m_last_progress >= interval))
+    {
+        m_last_progress = now;
+        print_progress(totals, ops_per_second, last);
+    }
+
+    if (m_metrics_path && (last || now - m_last_write >= METRICS_INTERVAL))
+    {
+        m_last_write = now;
+        write_metrics(totals, ops_per_second);
+    }
+}
+
+void MetricsReporter::print_progress(const Metrics::Totals& totals, double ops_per_second, bool last)
+{
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - m_started).count();
+    auto line = std::format("{}s: {} directories, {} entries, {} matched, {} operations ({:.0f}/s), {} written",
+        seconds, totals[Metrics::DIRECTORIES], totals[Metrics::ENTRIES], totals[Metrics::MATCHES],
+        totals[Metrics::OPERATIONS], ops_per_second, format_bytes(totals[Metrics::BYTES]));
+
+    // on a terminal the line is redrawn in place and only left behind once the run is over
+    if (m_interactive)
+    {
+        std::cerr << "\r\x1b[K" << line << (last ? "\n" : "") << std::flush;
+    }
+    else
+    {
+        std::cerr << line << '\n' << std::flush;
+    }
+}
+
+void MetricsReporter::write_metrics(const Metrics::Totals& totals, double ops_per_second)
+{
+    struct Series
+    {
+        const char* m_name;
+        const char* m_type;
+        const char* m_help;
+        std::string m_value;
+    };
+
+    const Series series[] = {
+        { "fsql_directories_walked_total", "counter", "Directories listed.", std::to_string(totals[Metrics::DIRECTORIES]) },
+        { "fsql_entries_seen_total", "counter", "Entries found in listed directories.", std::to_string(totals[Metrics::ENTRIES]) },
+        { "fsql_entries_matched_total", "counter", "Entries handed to an operation.", std::to_string(totals[Metrics::MATCHES]) },
+        { "fsql_operations_total", "counter", "Disk operations carried out.", std::to_string(totals[Metrics::OPERATIONS]) },
+        { "fsql_bytes_copied_total", "counter", "Bytes copied by disk operations.", std::to_string(totals[Metrics::BYTES]) },
+        { "fsql_operations_per_second", "gauge", "Disk operations carried out per second recently.", std::format("{:.1f}", ops_per_second) },
+    };
+
+    std::string text;
+    for (const auto& [name, type, help, value] : series)
+    {
+        text += std::format("# HELP {} {}\n# TYPE {} {}\n{} {}\n", name, help, name, type, name, value);
+    }
+
+    // written next to the file and renamed over it, so a collector never reads a partial file
+    try
+    {
+        auto temporary_path = *m_metrics_path;
+        temporary_path += ".tmp";
+        {
+            std::ofstream file(temporary_path, std::ios::trunc);
+            file << text;
+            if (!file.flush())
+            {
+                throw fs::filesystem_error("could not write", temporary_path, std::make_error_code(std::errc::io_error));
+            }
+        }
+        fs::rename(temporary_path, *m_metrics_path);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "could not write metrics: " << e.what() << '\n';
+    }
+}
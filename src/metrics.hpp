@@ -0,0 +1,105 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "thread_pool.hpp"
+
+// process-wide counters of the work done so far. every worker counts into a slot of its own with plain
+// relaxed stores, so counting never contends and costs about as much as an increment. readers add the
+// slots up whenever they like, and may see a count a moment late.
+class Metrics
+{
+    public:
+        enum Counter
+        {
+            DIRECTORIES,
+            ENTRIES,
+            MATCHES,
+            OPERATIONS,
+            BYTES,
+            N_COUNTERS
+        };
+
+        using Totals = std::array<std::uint64_t, N_COUNTERS>;
+
+        static Metrics& shared();
+
+        void add(Counter counter, std::uint64_t n = 1)
+        {
+            auto index = ThreadPool::worker_index();
+            if (index < m_n_workers)
+            {
+                auto& count = m_slots[index].m_counts[counter];
+                count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+            else
+            {
+                // threads outside of the pool share the last slot
+                m_slots[m_n_workers].m_counts[counter].fetch_add(n, std::memory_order_relaxed);
+            }
+        };
+
+        Totals totals() const;
+
+    private:
+        Metrics(std::size_t n_workers) : m_n_workers(n_workers), m_slots(std::make_unique<Slot[]>(n_workers + 1)) {};
+
+    private:
+        // padded so that neighbouring workers never share a cache line
+        struct alignas(64) Slot
+        {
+            std::array<std::atomic<std::uint64_t>, N_COUNTERS> m_counts{};
+        };
+
+        std::size_t m_n_workers;
+        std::unique_ptr<Slot[]> m_slots;
+};
+
+// reports the metrics while a run goes on: a progress line on standard error that is redrawn in place on
+// a terminal, and a file in the Prometheus text format for the textfile collector of node_exporter. the
+// file is replaced atomically, so it is never read half written. both are updated once more when the
+// reporter is destroyed.
+class MetricsReporter
+{
+    public:
+        MetricsReporter(bool progress, std::optional<std::filesystem::path> metrics_path);
+        ~MetricsReporter();
+
+        MetricsReporter(const MetricsReporter&) = delete;
+        MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        void report(bool last);
+        void print_progress(const Metrics::Totals& totals, double ops_per_second, bool last);
+        void write_metrics(const Metrics::Totals& totals, double ops_per_second);
+
+    private:
+        bool m_progress;
+        bool m_interactive;
+        std::optional<std::filesystem::path> m_metrics_path;
+
+        Clock::time_point m_started;
+        Clock::time_point m_last_report;
+        Clock::time_point m_last_progress;
+        Clock::time_point m_last_write;
+        std::uint64_t m_last_operations;
+
+        std::mutex m_mutex;
+        std::condition_variable m_stopped_condition;
+        bool m_stopped;
+        std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "name_block.hpp"
+
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "pattern.hpp"
+
+namespace
+{
+    void select(NameSelection& selection, std::size_t index)
+    {
+        selection[index / 64] |= std::uint64_t(1) << (index % 64);
+    }
+}
+
+void select_extension(const NameBlock& names, std::string_view extension, NameSelection& selection)
+{
+    selection.assign((names.size() + 63) / 64, 0);
+
+    // a name has no extension when it has no dot, or only the one it starts with
+    if (extension.empty())
+    {
+        for (std::size_t i = 0; i < names.size(); i++)
+        {
+            auto dot = names.name(i).find_last_of('.');
+            if (dot == std::string_view::npos || dot == 0)
+            {
+                select(selection, i);
+            }
+        }
+        return;
+    }
+
+    // an extension starts at the last dot of a name, so one with another dot in it never matches. other
+    // than that, a name has the extension exactly when it ends with it and has something in front of it.
+    // listings never hold "." or "..", whose extension is empty.
+    if (extension[0] != '.' || extension.find('.', 1) != std::string_view::npos)
+    {
+        return;
+    }
+
+    auto size = extension.size();
+#if defined(__SSE2__)
+    if (size <= NameBlock::PADDING)
+    {
+        // the last 16 bytes of every name are compared with the extension aligned to their end in one go,
+        // and only the comparisons of the bytes the extension covers have to hold
+        alignas(16) char suffix[16] = {};
+        std::memcpy(suffix + 16 - size, extension.data(), size);
+        auto wanted = _mm_load_si128(reinterpret_cast<const __m128i*>(suffix));
+        auto covered = 0xffffu & ~((1u << (16 - size)) - 1);
+
+        for (std::size_t i = 0; i < names.size(); i++)
+        {
+            auto tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(names.end_of(i) - 16));
+            auto equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(tail, wanted)));
+            if ((equal & covered) == covered && names.size_of(i) > size)
+            {
+                select(selection, i);
+            }
+        }
+        return;
+    }
+#endif
+
+    for (std::size_t i = 0; i < names.size(); i++)
+    {
+        if (names.size_of(i) > size && std::memcmp(names.end_of(i) - size, extension.data(), size) == 0)
+        {
+            select(selection, i);
+        }
+    }
+}
+
+void select_pattern(const NameBlock& names, const NamePattern& pattern, NameSelection& selection)
+{
+    selection.assign((names.size() + 63) / 64, 0);
+    for (std::size_t i = 0; i < names.size(); i++)
+    {
+        if (pattern.matches(names.name(i)))
+        {
+            select(selection, i);
+        }
+    }
+}
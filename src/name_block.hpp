@@ -0,0 +1,51 @@
+#ifndef NAME_BLOCK_HPP
+#define NAME_BLOCK_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class NamePattern;
+
+// the names of a directory listing stored back to back, so that rules which only look at names can be
+// evaluated over a whole listing at once. every name is preceded by at least PADDING bytes of the
+// block, which lets vector code load the PADDING bytes that end with any name.
+class NameBlock
+{
+    public:
+        static constexpr std::size_t PADDING = 16;
+
+        NameBlock() : m_data(PADDING, '\0') {};
+
+        void add(std::string_view name)
+        {
+            m_data.append(name);
+            m_ends.emplace_back(m_data.size());
+        };
+
+        std::size_t size() const { return m_ends.size(); };
+
+        const char* end_of(std::size_t index) const { return m_data.data() + m_ends[index]; };
+        std::size_t size_of(std::size_t index) const { return m_ends[index] - (index ? m_ends[index - 1] : PADDING); };
+        std::string_view name(std::size_t index) const { return { end_of(index) - size_of(index), size_of(index) }; };
+
+    private:
+        std::string m_data;
+        std::vector<std::uint32_t> m_ends;
+};
+
+// one bit per name of a block, set for the names a rule selects
+using NameSelection = std::vector<std::uint64_t>;
+
+inline bool selected(const NameSelection& selection, std::size_t index)
+{
+    return (selection[index / 64] >> (index % 64)) & 1;
+}
+
+// selects the names whose extension, as std::filesystem::path::extension() sees it, is extension
+void select_extension(const NameBlock& names, std::string_view extension, NameSelection& selection);
+
+void select_pattern(const NameBlock& names, const NamePattern& pattern, NameSelection& selection);
+
+#endif
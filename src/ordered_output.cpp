@@ -0,0 +1,68 @@
+#include "ordered_output.hpp"
+
+OrderedOutput::OrderedOutput(std::ostream& destination, std::size_t n_queries) : m_destination(destination), m_head(0)
+{
+    for (std::size_t i = 0; i < n_queries; i++)
+    {
+        m_queries.emplace_back(std::make_unique<Query>(*this));
+    }
+    if (!m_queries.empty())
+    {
+        m_queries.front()->m_buffer.m_direct = true;
+    }
+}
+
+void OrderedOutput::finish(std::size_t query)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_queries[query]->m_finished = true;
+
+    // hands over the buffers of the queries that finished in the meantime, up to the first one that is
+    // still running, which writes through from now on
+    for (; m_head < m_queries.size(); m_head++)
+    {
+        auto& head = *m_queries[m_head];
+        m_destination << head.m_buffer.m_pending;
+        head.m_buffer.m_pending = std::string();
+        if (!head.m_finished)
+        {
+            head.m_buffer.m_direct = true;
+            break;
+        }
+    }
+    m_destination.flush();
+}
+
+std::streamsize OrderedOutput::Buffer::xsputn(const char* data, std::streamsize size)
+{
+    std::lock_guard<std::mutex> guard(m_output.m_mutex);
+    if (m_direct)
+    {
+        m_output.m_destination.write(data, size);
+    }
+    else
+    {
+        m_pending.append(data, size);
+    }
+    return size;
+}
+
+OrderedOutput::Buffer::int_type OrderedOutput::Buffer::overflow(int_type ch)
+{
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        char data = traits_type::to_char_type(ch);
+        xsputn(&data, 1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int OrderedOutput::Buffer::sync()
+{
+    std::lock_guard<std::mutex> guard(m_output.m_mutex);
+    if (m_direct)
+    {
+        m_output.m_destination.flush();
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef ORDERED_OUTPUT_HPP
+#define ORDERED_OUTPUT_HPP
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// the output of the queries of a script that run at the same time, written to the destination in
+// script order. the earliest query that has not finished writes through, the others write into buffers
+// that are handed over once every query before them has finished.
+class OrderedOutput
+{
+    public:
+        OrderedOutput(std::ostream& destination, std::size_t n_queries);
+
+        std::ostream& stream(std::size_t query) { return *m_queries[query]->m_stream; };
+
+        // must be called once the query has written everything, even when it failed
+        void finish(std::size_t query);
+
+    private:
+        class Buffer : public std::streambuf
+        {
+            public:
+                Buffer(OrderedOutput& output) : m_output(output), m_direct(false) {};
+
+            protected:
+                std::streamsize xsputn(const char* data, std::streamsize size);
+                int_type overflow(int_type ch);
+                int sync();
+
+            private:
+                friend class OrderedOutput;
+
+                OrderedOutput& m_output;
+                std::string m_pending;
+                bool m_direct;
+        };
+
+        struct Query
+        {
+            Query(OrderedOutput& output) : m_buffer(output), m_stream(std::make_unique<std::ostream>(&m_buffer)), m_finished(false) {};
+
+            Buffer m_buffer;
+            std::unique_ptr<std::ostream> m_stream;
+            bool m_finished;
+        };
+
+    private:
+        std::ostream& m_destination;
+        std::vector<std::unique_ptr<Query>> m_queries;
+        std::size_t m_head;
+        std::mutex m_mutex;
+};
+
+#endif
@@ -1,8 +1,65 @@
 #include "parser.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <format>
 #include <iostream>
+#include <limits>
 
-Parser::Parser(std::istream& is) : m_token_pos(0)
+namespace
+{
+    constexpr std::int64_t NANOSECONDS_PER_SECOND = 1'000'000'000;
+
+    // timestamps are kept in nanoseconds, which covers the years 1678 to 2262
+    constexpr std::int64_t MAX_SECONDS = std::numeric_limits<std::int64_t>::max() / NANOSECONDS_PER_SECOND;
+    constexpr std::int64_t MIN_SECONDS = std::numeric_limits<std::int64_t>::min() / NANOSECONDS_PER_SECOND;
+}
+
+// nanoseconds since the unix epoch of a local date written as YYYY-MM-DD [HH:MM[:SS]]
+std::int64_t parse_timestamp(const std::string& date)
+{
+    std::tm time{};
+    int n_consumed = 0;
+    int n_fields = std::sscanf(date.c_str(), "%d-%d-%d%n %d:%d%n:%d%n", &time.tm_year, &time.tm_mon, &time.tm_mday, &n_consumed,
+        &time.tm_hour, &time.tm_min, &n_consumed, &time.tm_sec, &n_consumed);
+    if ((n_fields != 3 && n_fields != 5 && n_fields != 6) || n_consumed != static_cast<int>(date.size()))
+    {
+        throw std::runtime_error("invalid syntax: expected date as YYYY-MM-DD [HH:MM[:SS]]");
+    }
+
+    // mktime would roll fields that are out of range over into the next ones, so 2024-02-30 is rejected
+    // instead of read as a date in march
+    int year = time.tm_year, month = time.tm_mon, day = time.tm_mday;
+    if (year < 1 || year > 9999 || month < 1 || month > 12 || day < 1 || day > 31 || time.tm_hour < 0 || time.tm_hour > 23 ||
+        time.tm_min < 0 || time.tm_min > 59 || time.tm_sec < 0 || time.tm_sec > 60)
+    {
+        throw std::runtime_error(std::format("invalid syntax: {} is not a valid date", date));
+    }
+
+    time.tm_year -= 1900;
+    time.tm_mon -= 1;
+    time.tm_isdst = -1;
+    auto seconds = std::mktime(&time);
+    if (seconds == static_cast<std::time_t>(-1) && (time.tm_year != 69 || time.tm_mon != 11 || time.tm_mday != 31))
+    {
+        throw std::runtime_error(std::format("invalid syntax: {} is not a valid date", date));
+    }
+    if (time.tm_year + 1900 != year || time.tm_mon + 1 != month || time.tm_mday != day)
+    {
+        throw std::runtime_error(std::format("invalid syntax: {} is not a valid date", date));
+    }
+    if (seconds > MAX_SECONDS || seconds < MIN_SECONDS)
+    {
+        throw std::runtime_error(std::format("invalid syntax: {} is out of the supported range of dates", date));
+    }
+    return static_cast<std::int64_t>(seconds) * NANOSECONDS_PER_SECOND;
+}
+
+Parser::Parser(std::istream& is, const std::filesystem::path& working_directory) 
+    : m_token_pos(0), m_working_directory(working_directory)
 {
     lexer::generate_tokens(is, m_tokens);
 }
@@ -20,10 +77,37 @@ void Parser::push_back_token()
     }
 }
 
+std::string Parser::source_key(std::uint32_t begin, std::uint32_t end)
+{
+    // paths read from stdin are gone once they have been read, so sub-queries over them never match.
+    // neither do sub-queries over manifests, whose entries carry the metadata they were saved with and
+    // are checked against it before disk operations act on them, which a replay would not keep.
+    std::string key;
+    for (auto i = begin; i < end; i++)
+    {
+        if (m_tokens[i].m_type == lexer::TokenType::STDIN || m_tokens[i].m_type == lexer::TokenType::MANIFEST)
+        {
+            return {};
+        }
+        key += std::format("{}:{}:{};", static_cast<int>(m_tokens[i].m_type), m_tokens[i].m_lexeme.size(), m_tokens[i].m_lexeme);
+    }
+    return key;
+}
+
 bool Parser::is_select_type(lexer::TokenType tokenType)
 {
     return (tokenType == lexer::TokenType::FILES) || (tokenType == lexer::TokenType::DIRECTORIES) ||
-        (tokenType == lexer::TokenType::ALL) || (tokenType == lexer::TokenType::RECURSIVE);
+        (tokenType == lexer::TokenType::ALL) || (tokenType == lexer::TokenType::RECURSIVE) ||
+        (tokenType == lexer::TokenType::DUPLICATES);
+}
+
+std::string Parser::resolve_path(const std::string& path)
+{
+    if (path.empty() || path.starts_with("~/") || std::filesystem::path(path).is_absolute())
+    {
+        return path;
+    }
+    return m_working_directory / path;
 }
 
 std::shared_ptr<Rule> Parser::primary_rule()
@@ -70,6 +154,96 @@ std::shared_ptr<Rule> Parser::primary_rule()
             }
             throw std::runtime_error("invalid syntax: expected comparison operator");
         }
+    case lexer::TokenType::MODIFIED:
+    case lexer::TokenType::ACCESSED:
+    case lexer::TokenType::CREATED:
+        {
+            auto timestamp_type = m_tokens[m_token_pos - 1].m_type;
+            auto comparison_tok = next_token();
+            if ((comparison_tok.m_type == lexer::TokenType::LTHAN) || (comparison_tok.m_type == lexer::TokenType::GTHAN))
+            {
+                auto threshold_tok = next_token();
+                if (threshold_tok.m_type == lexer::TokenType::STRING)
+                {
+                    // an absolute date compares timestamps: "modified > date" means modified after the date
+                    auto threshold = parse_timestamp(threshold_tok.m_lexeme);
+                    return std::make_shared<TimeRule>(timestamp_type, threshold, comparison_tok.m_type == lexer::TokenType::GTHAN);
+                }
+                else if (threshold_tok.m_type == lexer::TokenType::NUMBER)
+                {
+                    std::int64_t unit;
+                    switch (next_token().m_type)
+                    {
+                    case lexer::TokenType::SECONDS:
+                        unit = 1;
+                        break;
+                    case lexer::TokenType::MINUTES:
+                        unit = 60;
+                        break;
+                    case lexer::TokenType::HOURS:
+                        unit = 60 * 60;
+                        break;
+                    case lexer::TokenType::DAYS:
+                        unit = 24 * 60 * 60;
+                        break;
+                    case lexer::TokenType::WEEKS:
+                        unit = 7 * 24 * 60 * 60;
+                        break;
+                    default: throw std::runtime_error("invalid syntax: expected duration unit (s, m, h, d or w)");
+                    }
+
+                    // the age in nanoseconds has to fit the timestamps it is compared with
+                    const auto& lexeme = threshold_tok.m_lexeme;
+                    std::int64_t age = 0;
+                    auto [end, error] = std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), age);
+                    if (error != std::errc() || age > MAX_SECONDS / unit)
+                    {
+                        throw std::runtime_error(std::format("invalid syntax: duration {} is too long", lexeme));
+                    }
+                    auto age_nanoseconds = age * unit * NANOSECONDS_PER_SECOND;
+
+                    // a duration compares ages: "modified > 30d" means modified more than 30 days ago
+                    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+                    auto threshold = now < std::numeric_limits<std::int64_t>::min() + age_nanoseconds ?
+                        std::numeric_limits<std::int64_t>::min() : now - age_nanoseconds;
+                    return std::make_shared<TimeRule>(timestamp_type, threshold, comparison_tok.m_type == lexer::TokenType::LTHAN);
+                }
+                throw std::runtime_error("invalid syntax: expected duration or date");
+            }
+            throw std::runtime_error("invalid syntax: expected comparison operator");
+        }
+    case lexer::TokenType::NAME:
+        {
+            auto operator_tok = next_token();
+            auto& pattern_tok = next_token();
+            if (operator_tok.m_type == lexer::TokenType::LIKE)
+            {
+                if (pattern_tok.m_type == lexer::TokenType::STRING)
+                {
+                    return std::make_shared<NameRule>(pattern_tok.m_lexeme, false);
+                }
+                throw std::runtime_error("invalid syntax: expected string");
+            }
+            else if (operator_tok.m_type == lexer::TokenType::MATCHES)
+            {
+                if ((pattern_tok.m_type == lexer::TokenType::REGEX) || (pattern_tok.m_type == lexer::TokenType::STRING))
+                {
+                    return std::make_shared<NameRule>(pattern_tok.m_lexeme, true);
+                }
+                throw std::runtime_error("invalid syntax: expected /regex/");
+            }
+            throw std::runtime_error("invalid syntax: expected like or matches");
+        }
+    case lexer::TokenType::CONTAINS:
+        {
+            auto& string_tok = next_token();
+            if (string_tok.m_type == lexer::TokenType::STRING)
+            {
+                return std::make_shared<ContentRule>(string_tok.m_lexeme);
+            }
+            throw std::runtime_error("invalid syntax: expected string");
+        }
     case lexer::TokenType::LPAREN:
         {
             auto compound_rule = and_rule();
@@ -86,30 +260,24 @@ std::shared_ptr<Rule> Parser::primary_rule()
 std::shared_ptr<Rule> Parser::or_rule()
 {
     std::shared_ptr<Rule> lhs = primary_rule();
-    if (next_token().m_type == lexer::TokenType::OR) 
+    while (next_token().m_type == lexer::TokenType::OR) 
     {
         std::shared_ptr<Rule> rhs = primary_rule();
-        return std::make_shared<OrRule>(lhs, rhs);
-    }
-    else
-    {
-        push_back_token();
+        lhs = std::make_shared<OrRule>(lhs, rhs);
     }
+    push_back_token();
     return lhs;
 }
 
 std::shared_ptr<Rule> Parser::and_rule()
 {
     std::shared_ptr<Rule> lhs = or_rule();
-    if (next_token().m_type == lexer::TokenType::AND)
+    while (next_token().m_type == lexer::TokenType::AND)
     {
         std::shared_ptr<Rule> rhs = or_rule();
-        return std::make_shared<AndRule>(lhs, rhs);
-    }
-    else
-    {
-        push_back_token();
+        lhs = std::make_shared<AndRule>(lhs, rhs);
     }
+    push_back_token();
     return lhs;
 }
 
@@ -124,7 +292,7 @@ std::shared_ptr<DiskOperation> Parser::disk_operation()
         auto& destination_path = next_token();
         if (destination_path.m_type == lexer::TokenType::STRING)
         {
-            return std::make_shared<CopyOp>(destination_path.m_lexeme);
+            return std::make_shared<CopyOp>(resolve_path(destination_path.m_lexeme));
         }
         throw std::runtime_error("invalid syntax: expected string");
     }
@@ -133,16 +301,280 @@ std::shared_ptr<DiskOperation> Parser::disk_operation()
         auto& destination_path = next_token();
         if (destination_path.m_type == lexer::TokenType::STRING)
         {
-            return std::make_shared<MoveOp>(destination_path.m_lexeme);
+            return std::make_shared<MoveOp>(resolve_path(destination_path.m_lexeme));
+        }
+        throw std::runtime_error("invalid syntax: expected string");
+    }
+    case lexer::TokenType::SYNC:
+    {
+        auto& destination_path = next_token();
+        if (destination_path.m_type != lexer::TokenType::STRING)
+        {
+            throw std::runtime_error("invalid syntax: expected string");
+        }
+
+        bool checksum = false, dry_run = false;
+        for (bool options = true; options;)
+        {
+            switch (next_token().m_type)
+            {
+            case lexer::TokenType::CHECKSUM:
+                checksum = true;
+                break;
+            case lexer::TokenType::DRY:
+                dry_run = true;
+                break;
+            default:
+                push_back_token();
+                options = false;
+                break;
+            }
+        }
+        return std::make_shared<SyncOp>(resolve_path(destination_path.m_lexeme), checksum, dry_run);
+    }
+    case lexer::TokenType::SAVE:
+    {
+        auto& manifest_path = next_token();
+        if (manifest_path.m_type == lexer::TokenType::STRING)
+        {
+            return std::make_shared<SaveOp>(resolve_path(manifest_path.m_lexeme));
         }
         throw std::runtime_error("invalid syntax: expected string");
     }
+    case lexer::TokenType::COUNT:
+    case lexer::TokenType::SUM:
+    case lexer::TokenType::MIN:
+    case lexer::TokenType::MAX:
+        push_back_token();
+        return aggregate_operation(false);
+    case lexer::TokenType::APPROX:
+        return aggregate_operation(true);
     default: throw std::runtime_error("invalid syntax: expected operation keyword");
     }
 }
 
+std::shared_ptr<DiskOperation> Parser::aggregate_operation(bool approximate)
+{
+    Aggregation aggregation;
+    do
+    {
+        auto aggregate_type = next_token().m_type;
+        if (aggregate_type == lexer::TokenType::COUNT)
+        {
+            aggregation.m_aggregates.emplace_back(Aggregate::COUNT);
+            continue;
+        }
+
+        switch (aggregate_type)
+        {
+        case lexer::TokenType::SUM:
+            aggregation.m_aggregates.emplace_back(Aggregate::SUM_SIZE);
+            break;
+        case lexer::TokenType::MIN:
+            aggregation.m_aggregates.emplace_back(Aggregate::MIN_SIZE);
+            break;
+        case lexer::TokenType::MAX:
+            aggregation.m_aggregates.emplace_back(Aggregate::MAX_SIZE);
+            break;
+        default: throw std::runtime_error("invalid syntax: expected count, sum, min or max");
+        }
+
+        if ((next_token().m_type != lexer::TokenType::LPAREN) || (next_token().m_type != lexer::TokenType::SIZE) ||
+            (next_token().m_type != lexer::TokenType::RPAREN))
+        {
+            throw std::runtime_error("invalid syntax: expected (size)");
+        }
+    } while (next_token().m_type == lexer::TokenType::COMMA);
+    push_back_token();
+
+    if (next_token().m_type == lexer::TokenType::GROUP)
+    {
+        if (next_token().m_type != lexer::TokenType::BY)
+        {
+            throw std::runtime_error("invalid syntax: missing by");
+        }
+
+        switch (next_token().m_type)
+        {
+        case lexer::TokenType::EXTENSION:
+            aggregation.m_group_key = GroupKey::EXTENSION;
+            break;
+        case lexer::TokenType::DIRECTORY:
+            aggregation.m_group_key = GroupKey::DIRECTORY;
+            break;
+        default: throw std::runtime_error("invalid syntax: expected extension or directory");
+        }
+    }
+    else
+    {
+        push_back_token();
+    }
+
+    if (approximate)
+    {
+        approximation(aggregation);
+    }
+    return std::make_shared<AggregateOp>(aggregation);
+}
+
+void Parser::approximation(Aggregation& aggregation)
+{
+    // only sums over the whole tree can be extrapolated from the directories a probe visits
+    bool extrapolated = std::all_of(aggregation.m_aggregates.begin(), aggregation.m_aggregates.end(), [](Aggregate aggregate) {
+        return aggregate == Aggregate::COUNT || aggregate == Aggregate::SUM_SIZE;
+    });
+    if (!extrapolated || aggregation.m_group_key != GroupKey::NONE)
+    {
+        throw std::runtime_error("invalid syntax: approx only supports count and sum(size) without group by");
+    }
+
+    auto& approximation = aggregation.m_approximation.emplace();
+    if (next_token().m_type == lexer::TokenType::WITHIN)
+    {
+        auto& error_tok = next_token();
+        bool number = error_tok.m_type == lexer::TokenType::NUMBER || error_tok.m_type == lexer::TokenType::DECIMAL;
+        if (!number || next_token().m_type != lexer::TokenType::PERCENT)
+        {
+            throw std::runtime_error("invalid syntax: expected error bound as N%");
+        }
+
+        approximation.m_error = std::stod(error_tok.m_lexeme) / 100.0;
+        if (approximation.m_error <= 0)
+        {
+            throw std::runtime_error("invalid syntax: error bound must be above 0%");
+        }
+    }
+    else
+    {
+        push_back_token();
+    }
+
+    if (next_token().m_type == lexer::TokenType::FOR)
+    {
+        auto& budget_tok = next_token();
+        if (budget_tok.m_type != lexer::TokenType::NUMBER)
+        {
+            throw std::runtime_error("invalid syntax: expected number");
+        }
+
+        std::uint64_t budget = std::stoull(budget_tok.m_lexeme);
+        switch (next_token().m_type)
+        {
+        case lexer::TokenType::SECONDS: break;
+        case lexer::TokenType::MINUTES:
+            budget *= 60;
+            break;
+        case lexer::TokenType::HOURS:
+            budget *= 60 * 60;
+            break;
+        default: throw std::runtime_error("invalid syntax: expected duration unit (s, m or h)");
+        }
+        approximation.m_budget = std::chrono::seconds(budget);
+    }
+    else
+    {
+        push_back_token();
+    }
+}
+
+std::shared_ptr<Ordering> Parser::ordering()
+{
+    if (next_token().m_type != lexer::TokenType::BY)
+    {
+        throw std::runtime_error("invalid syntax: missing by");
+    }
+
+    std::shared_ptr<Ordering> ordering = std::make_shared<Ordering>();
+    switch (next_token().m_type)
+    {
+    case lexer::TokenType::SIZE:
+        ordering->m_key = OrderKey::SIZE;
+        break;
+    case lexer::TokenType::MODIFIED:
+        ordering->m_key = OrderKey::MODIFIED;
+        break;
+    case lexer::TokenType::NAME:
+        ordering->m_key = OrderKey::NAME;
+        break;
+    default: throw std::runtime_error("invalid syntax: expected size, modified or name");
+    }
+
+    switch (next_token().m_type)
+    {
+    case lexer::TokenType::ASC: break;
+    case lexer::TokenType::DESC:
+        ordering->m_descending = true;
+        break;
+    default:
+        push_back_token();
+        break;
+    }
+
+    return ordering;
+}
+
+std::shared_ptr<Traversal> Parser::traversal()
+{
+    std::shared_ptr<Traversal> traversal = nullptr;
+    while (true)
+    {
+        switch (next_token().m_type)
+        {
+        case lexer::TokenType::EXCLUDE:
+            traversal = traversal ? traversal : std::make_shared<Traversal>();
+            do
+            {
+                auto& pattern_tok = next_token();
+                if (pattern_tok.m_type != lexer::TokenType::STRING)
+                {
+                    throw std::runtime_error("invalid syntax: expected string");
+                }
+                traversal->m_excluded.emplace_back(NamePattern::glob(pattern_tok.m_lexeme));
+            } while (next_token().m_type == lexer::TokenType::COMMA);
+            push_back_token();
+            break;
+        case lexer::TokenType::DEPTH:
+            {
+                traversal = traversal ? traversal : std::make_shared<Traversal>();
+                if (next_token().m_type != lexer::TokenType::LTHAN)
+                {
+                    throw std::runtime_error("invalid syntax: expected < or <=");
+                }
+
+                bool inclusive = next_token().m_type == lexer::TokenType::EQ;
+                if (!inclusive)
+                {
+                    push_back_token();
+                }
+
+                auto& depth_tok = next_token();
+                if (depth_tok.m_type != lexer::TokenType::NUMBER)
+                {
+                    throw std::runtime_error("invalid syntax: expected number");
+                }
+
+                auto max_depth = std::stoull(depth_tok.m_lexeme);
+                traversal->m_max_depth = inclusive ? max_depth : (max_depth ? max_depth - 1 : 0);
+                break;
+            }
+        case lexer::TokenType::FOLLOW:
+            traversal = traversal ? traversal : std::make_shared<Traversal>();
+            if (next_token().m_type != lexer::TokenType::SYMLINKS)
+            {
+                throw std::runtime_error("invalid syntax: expected symlinks");
+            }
+            traversal->m_follow_symlinks = true;
+            break;
+        default:
+            push_back_token();
+            return traversal;
+        }
+    }
+}
+
 std::shared_ptr<CompoundElement> Parser::compound_element()
 {
+    auto first_token = m_token_pos;
     if (next_token().m_type == lexer::TokenType::SELECT)
     {
         lexer::TokenType select_type;
@@ -150,6 +582,7 @@ std::shared_ptr<CompoundElement> Parser::compound_element()
         {
             std::shared_ptr<CompoundElement> compound_element = std::make_shared<CompoundElement>(select_type);
             compound_element->m_elements = element_list();
+            compound_element->m_traversal = traversal();
 
             if (next_token().m_type == lexer::TokenType::WHERE)
             {
@@ -161,6 +594,7 @@ std::shared_ptr<CompoundElement> Parser::compound_element()
             }
             if (next_token().m_type == lexer::TokenType::RPAREN)
             {
+                compound_element->m_key = source_key(first_token, m_token_pos);
                 return compound_element;
             }
 
@@ -176,13 +610,26 @@ std::shared_ptr<Element> Parser::element()
     auto& tok = next_token();
     if (tok.m_type == lexer::TokenType::STRING)
     {
-        return std::make_shared<AtomicElement>(tok.m_lexeme);
+        return std::make_shared<AtomicElement>(resolve_path(tok.m_lexeme));
     }
     else if (tok.m_type == lexer::TokenType::LPAREN)
     {
         return compound_element();
     }
-    throw std::runtime_error("invalid syntax: expected string or sub-query");
+    else if (tok.m_type == lexer::TokenType::MANIFEST)
+    {
+        auto& manifest_path = next_token();
+        if (manifest_path.m_type == lexer::TokenType::STRING)
+        {
+            return std::make_shared<ManifestElement>(resolve_path(manifest_path.m_lexeme));
+        }
+        throw std::runtime_error("invalid syntax: expected string");
+    }
+    else if (tok.m_type == lexer::TokenType::STDIN)
+    {
+        return std::make_shared<StdinElement>();
+    }
+    throw std::runtime_error("invalid syntax: expected string, sub-query, manifest or stdin");
 }
 
 std::vector<std::shared_ptr<Element>> Parser::element_list()
@@ -205,6 +652,7 @@ std::shared_ptr<Query> Parser::query()
         {
             std::shared_ptr<Query> query = std::make_shared<Query>(select_type);
             query->m_elements = element_list();
+            query->m_traversal = traversal();
 
             if (next_token().m_type == lexer::TokenType::WHERE)
             {
@@ -215,6 +663,38 @@ std::shared_ptr<Query> Parser::query()
                 push_back_token();
             }
 
+            if (next_token().m_type == lexer::TokenType::ORDER)
+            {
+                query->m_ordering = ordering();
+            }
+            else
+            {
+                push_back_token();
+            }
+
+            if (next_token().m_type == lexer::TokenType::LIMIT)
+            {
+                auto& limit_tok = next_token();
+                if (limit_tok.m_type != lexer::TokenType::NUMBER)
+                {
+                    throw std::runtime_error("invalid syntax: expected number");
+                }
+
+                // an ordered query has to see every entry, so its limit only bounds the heaps
+                if (query->m_ordering)
+                {
+                    query->m_ordering->m_limit = std::stoull(limit_tok.m_lexeme);
+                }
+                else
+                {
+                    query->m_limit = std::stoull(limit_tok.m_lexeme);
+                }
+            }
+            else
+            {
+                push_back_token();
+            }
+
             query->m_disk_operation = disk_operation();
 
             if (next_token().m_type == lexer::TokenType::SEMICOL)
@@ -6,7 +6,8 @@
 class Parser
 {
     public:
-        Parser(std::istream& is);
+        // relative paths in the script are resolved against working_directory
+        Parser(std::istream& is, const std::filesystem::path& working_directory = std::filesystem::current_path());
 
         std::unique_ptr<AST> build_ast();
 
@@ -18,6 +19,10 @@ class Parser
         std::shared_ptr<Element> element();
         std::shared_ptr<CompoundElement> compound_element();
         std::shared_ptr<DiskOperation> disk_operation();
+        std::shared_ptr<DiskOperation> aggregate_operation(bool approximate);
+        void approximation(Aggregation& aggregation);
+        std::shared_ptr<Ordering> ordering();
+        std::shared_ptr<Traversal> traversal();
         std::vector<std::shared_ptr<Element>> element_list();
 
         std::shared_ptr<Rule> and_rule();
@@ -26,9 +31,14 @@ class Parser
 
         bool is_select_type(lexer::TokenType tokenType);
 
+        // identifies the tokens in [begin, end), so that sub-queries written the same way share a key
+        std::string source_key(std::uint32_t begin, std::uint32_t end);
+        std::string resolve_path(const std::string& path);
+
     private:
         std::vector<lexer::Token> m_tokens;
         std::uint32_t m_token_pos;
+        std::filesystem::path m_working_directory;
 };
 
 #endif
@@ -0,0 +1,97 @@
+#include "path_arena.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+PathArena::PathArena() : m_block_used(BLOCK_SIZE)
+{
+    // the root node stands for the empty path every other path starts from
+    m_nodes.emplace_back(Node{ ROOT, {} });
+}
+
+std::pair<PathArena::Id, bool> PathArena::intern(const fs::path& path)
+{
+    std::string_view native = path.native();
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    std::pair<Id, bool> node = { ROOT, false };
+    if (native.starts_with('/'))
+    {
+        node = child(ROOT, "/");
+    }
+
+    // empty components from repeated or trailing separators are skipped
+    for (std::size_t begin = 0, end; begin < native.size(); begin = end + 1)
+    {
+        end = std::min(native.find('/', begin), native.size());
+        if (end > begin)
+        {
+            node = child(node.first, native.substr(begin, end - begin));
+        }
+    }
+    return node;
+}
+
+fs::path PathArena::path(Id id) const
+{
+    std::vector<std::string_view> names;
+    std::size_t length = 0;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (; id != ROOT; id = m_nodes[id].m_parent)
+        {
+            names.emplace_back(m_nodes[id].m_name);
+            length += m_nodes[id].m_name.size() + 1;
+        }
+    }
+
+    std::string native;
+    native.reserve(length);
+    for (auto name = names.rbegin(); name != names.rend(); name++)
+    {
+        if (!native.empty() && native.back() != '/')
+        {
+            native += '/';
+        }
+        native += *name;
+    }
+    return native;
+}
+
+std::size_t PathArena::size() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_nodes.size() - 1;
+}
+
+std::pair<PathArena::Id, bool> PathArena::child(Id parent, std::string_view name)
+{
+    auto existing = m_children.find(ChildKey{ parent, name });
+    if (existing != m_children.end())
+    {
+        return { existing->second, false };
+    }
+
+    Id id = m_nodes.size();
+    auto stored_name = store_name(name);
+    m_nodes.emplace_back(Node{ parent, stored_name });
+    m_children.emplace(ChildKey{ parent, stored_name }, id);
+    return { id, true };
+}
+
+std::string_view PathArena::store_name(std::string_view name)
+{
+    // names longer than a block get a block of their own
+    if (m_block_used + name.size() > BLOCK_SIZE)
+    {
+        m_blocks.emplace_back(std::make_unique<char[]>(std::max(name.size(), BLOCK_SIZE)));
+        m_block_used = 0;
+    }
+
+    char* stored = m_blocks.back().get() + m_block_used;
+    std::memcpy(stored, name.data(), name.size());
+    m_block_used += name.size();
+    return { stored, name.size() };
+}
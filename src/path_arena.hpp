@@ -0,0 +1,71 @@
+#ifndef PATH_ARENA_HPP
+#define PATH_ARENA_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// interned paths stored as a tree of (parent, name) nodes whose names live in a shared character
+// arena. every directory is stored once no matter how many paths go through it, so a large set of
+// results under a common prefix takes a fraction of the memory of as many std::filesystem::paths.
+// a path is only materialized again when it has to be handed to a system call.
+class PathArena
+{
+    public:
+        using Id = std::uint32_t;
+
+        PathArena();
+
+        // the id of path, and whether path was interned for the first time
+        std::pair<Id, bool> intern(const std::filesystem::path& path);
+
+        std::filesystem::path path(Id id) const;
+
+        std::size_t size() const;
+
+    private:
+        struct Node
+        {
+            Id m_parent;
+            std::string_view m_name;
+        };
+
+        struct ChildKey
+        {
+            Id m_parent;
+            std::string_view m_name;
+
+            bool operator==(const ChildKey& other) const = default;
+        };
+
+        struct ChildKeyHash
+        {
+            std::size_t operator()(const ChildKey& key) const
+            {
+                return std::hash<std::string_view>()(key.m_name) ^ (static_cast<std::size_t>(key.m_parent) * 0x9e3779b97f4a7c15ULL);
+            }
+        };
+
+        static constexpr Id ROOT = 0;
+        static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+        // must be called with the mutex held
+        std::pair<Id, bool> child(Id parent, std::string_view name);
+        std::string_view store_name(std::string_view name);
+
+    private:
+        mutable std::mutex m_mutex;
+        std::vector<Node> m_nodes;
+        std::unordered_map<ChildKey, Id, ChildKeyHash> m_children;
+
+        // names are never moved once stored, so nodes and keys can point into the blocks
+        std::vector<std::unique_ptr<char[]>> m_blocks;
+        std::size_t m_block_used;
+};
+
+#endif
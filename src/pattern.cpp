@@ -0,0 +1,570 @@
+#include "pattern.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <format>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using ByteSet = std::bitset<256>;
+
+struct NamePattern::Node
+{
+    enum class Kind
+    {
+        BYTES,
+        CONCAT,
+        ALTERNATE,
+        REPEAT
+    };
+
+    static constexpr std::uint32_t UNBOUNDED = UINT32_MAX;
+
+    Kind m_kind;
+    ByteSet m_bytes = {};
+    std::vector<Node> m_children = {};
+    std::uint32_t m_min = 0;
+    std::uint32_t m_max = 0;
+};
+
+// thompson construction, where every state either consumes one byte out of a set or has epsilon moves
+struct NamePattern::Nfa
+{
+    struct State
+    {
+        ByteSet m_bytes;
+        std::int64_t m_next = -1;
+        std::vector<std::uint32_t> m_epsilon;
+    };
+
+    Nfa(const Node& root)
+    {
+        std::tie(m_start, m_accept) = build(root);
+    }
+
+    std::uint32_t add()
+    {
+        m_states.emplace_back();
+        return m_states.size() - 1;
+    }
+
+    void link(std::uint32_t from, std::uint32_t to)
+    {
+        m_states[from].m_epsilon.emplace_back(to);
+    }
+
+    std::pair<std::uint32_t, std::uint32_t> build(const Node& node)
+    {
+        auto start = add(), end = add();
+        switch (node.m_kind)
+        {
+        case Node::Kind::BYTES:
+            m_states[start].m_bytes = node.m_bytes;
+            m_states[start].m_next = end;
+            break;
+        case Node::Kind::CONCAT:
+            {
+                auto last = start;
+                for (const auto& child : node.m_children)
+                {
+                    auto [child_start, child_end] = build(child);
+                    link(last, child_start);
+                    last = child_end;
+                }
+                link(last, end);
+            }
+            break;
+        case Node::Kind::ALTERNATE:
+            for (const auto& child : node.m_children)
+            {
+                auto [child_start, child_end] = build(child);
+                link(start, child_start);
+                link(child_end, end);
+            }
+            break;
+        case Node::Kind::REPEAT:
+            {
+                auto last = start;
+                for (std::uint32_t i = 0; i < node.m_min; i++)
+                {
+                    auto [child_start, child_end] = build(node.m_children.front());
+                    link(last, child_start);
+                    last = child_end;
+                }
+
+                if (node.m_max == Node::UNBOUNDED)
+                {
+                    auto [child_start, child_end] = build(node.m_children.front());
+                    link(last, child_start);
+                    link(child_end, child_start);
+                    link(child_end, end);
+                }
+                else
+                {
+                    for (auto i = node.m_min; i < node.m_max; i++)
+                    {
+                        auto [child_start, child_end] = build(node.m_children.front());
+                        link(last, child_start);
+                        link(last, end);
+                        last = child_end;
+                    }
+                }
+                link(last, end);
+            }
+            break;
+        }
+        return { start, end };
+    }
+
+    std::vector<State> m_states;
+    std::uint32_t m_start;
+    std::uint32_t m_accept;
+};
+
+namespace
+{
+    using Node = NamePattern::Node;
+
+    constexpr std::uint32_t MAX_REPEAT = 256;
+    constexpr std::size_t MAX_STATES = 4096;
+
+    // nested repetitions multiply the copies of their operand, so the automaton is bounded before it is built
+    constexpr std::uint64_t MAX_NFA_STATES = 1 << 16;
+
+    // states the thompson construction allocates for node, saturating at MAX_NFA_STATES + 1
+    std::uint64_t nfa_states(const Node& node)
+    {
+        std::uint64_t states = 2;
+        switch (node.m_kind)
+        {
+        case Node::Kind::BYTES:
+            break;
+        case Node::Kind::CONCAT:
+        case Node::Kind::ALTERNATE:
+            for (const auto& child : node.m_children)
+            {
+                states = std::min(states + nfa_states(child), MAX_NFA_STATES + 1);
+            }
+            break;
+        case Node::Kind::REPEAT:
+            {
+                std::uint64_t copies = node.m_max == Node::UNBOUNDED ? node.m_min + 1 : node.m_max;
+                states = std::min(states + copies * nfa_states(node.m_children.front()), MAX_NFA_STATES + 1);
+            }
+            break;
+        }
+        return states;
+    }
+
+    Node bytes(const ByteSet& set)
+    {
+        return Node{ .m_kind = Node::Kind::BYTES, .m_bytes = set };
+    }
+
+    ByteSet byte_set(unsigned char ch)
+    {
+        ByteSet set;
+        set.set(ch);
+        return set;
+    }
+
+    Node byte(unsigned char ch)
+    {
+        return bytes(byte_set(ch));
+    }
+
+    Node any_sequence()
+    {
+        return Node{ .m_kind = Node::Kind::REPEAT, .m_children = { bytes(ByteSet().set()) }, .m_min = 0, .m_max = Node::UNBOUNDED };
+    }
+
+    ByteSet byte_range(unsigned char first, unsigned char last)
+    {
+        ByteSet set;
+        for (unsigned ch = first; ch <= last; ch++)
+        {
+            set.set(ch);
+        }
+        return set;
+    }
+
+    class PatternParser
+    {
+        public:
+            PatternParser(std::string_view pattern, bool glob) : m_pattern(pattern), m_pos(0), m_depth(0), m_glob(glob) {};
+
+            Node parse()
+            {
+                auto root = m_glob ? glob() : anchored_alternation();
+                if (!done())
+                {
+                    fail("unexpected )");
+                }
+                if (nfa_states(root) > MAX_NFA_STATES)
+                {
+                    fail("pattern is too complex");
+                }
+                return root;
+            }
+
+        private:
+            bool done() { return m_pos >= m_pattern.size(); };
+            char peek() { return m_pattern[m_pos]; };
+            char next() { return m_pattern[m_pos++]; };
+
+            [[noreturn]] void fail(const std::string& reason)
+            {
+                throw std::runtime_error(std::format("compilation error: invalid pattern {}: {}", std::string(m_pattern), reason));
+            }
+
+            Node glob()
+            {
+                Node concat{ .m_kind = Node::Kind::CONCAT };
+                while (!done())
+                {
+                    auto ch = next();
+                    switch (ch)
+                    {
+                    case '*':
+                        concat.m_children.emplace_back(any_sequence());
+                        break;
+                    case '?':
+                        concat.m_children.emplace_back(bytes(ByteSet().set()));
+                        break;
+                    case '[':
+                        concat.m_children.emplace_back(bytes(bracket()));
+                        break;
+                    case '\\':
+                        if (done())
+                        {
+                            fail("trailing \\");
+                        }
+                        concat.m_children.emplace_back(byte(next()));
+                        break;
+                    default:
+                        concat.m_children.emplace_back(byte(ch));
+                    }
+                }
+                return concat;
+            }
+
+            // the alternatives of a regular expression may match anywhere in the name, unless they are
+            // anchored with ^ or $ themselves. ^foo|bar$ matches foox and xbar, like grep -E.
+            Node anchored_alternation()
+            {
+                Node alternate{ .m_kind = Node::Kind::ALTERNATE };
+                do
+                {
+                    if (!alternate.m_children.empty())
+                    {
+                        next();
+                    }
+
+                    Node branch{ .m_kind = Node::Kind::CONCAT };
+                    if (!done() && peek() == '^')
+                    {
+                        next();
+                    }
+                    else
+                    {
+                        branch.m_children.emplace_back(any_sequence());
+                    }
+
+                    branch.m_children.emplace_back(concatenation());
+                    if (at_end_anchor())
+                    {
+                        next();
+                    }
+                    else
+                    {
+                        branch.m_children.emplace_back(any_sequence());
+                    }
+                    alternate.m_children.emplace_back(std::move(branch));
+                } while (!done() && peek() == '|');
+                return alternate.m_children.size() == 1 ? std::move(alternate.m_children.front()) : alternate;
+            }
+
+            // whether the next $ ends a top-level alternative, where it is an anchor
+            bool at_end_anchor()
+            {
+                return m_depth == 0 && !done() && peek() == '$' && (m_pos + 1 == m_pattern.size() || m_pattern[m_pos + 1] == '|');
+            }
+
+            Node alternation()
+            {
+                Node alternate{ .m_kind = Node::Kind::ALTERNATE };
+                alternate.m_children.emplace_back(concatenation());
+                while (!done() && peek() == '|')
+                {
+                    next();
+                    alternate.m_children.emplace_back(concatenation());
+                }
+                return alternate.m_children.size() == 1 ? std::move(alternate.m_children.front()) : alternate;
+            }
+
+            Node concatenation()
+            {
+                Node concat{ .m_kind = Node::Kind::CONCAT };
+                while (!done() && peek() != '|' && peek() != ')' && !at_end_anchor())
+                {
+                    concat.m_children.emplace_back(repetition());
+                }
+                return concat;
+            }
+
+            Node repetition()
+            {
+                auto node = atom();
+                while (!done())
+                {
+                    std::uint32_t min, max;
+                    switch (peek())
+                    {
+                    case '*': min = 0, max = Node::UNBOUNDED; break;
+                    case '+': min = 1, max = Node::UNBOUNDED; break;
+                    case '?': min = 0, max = 1; break;
+                    case '{':
+                        next();
+                        min = number();
+                        max = min;
+                        if (!done() && peek() == ',')
+                        {
+                            next();
+                            max = (!done() && peek() == '}') ? Node::UNBOUNDED : number();
+                        }
+                        if (done() || peek() != '}' || max < min)
+                        {
+                            fail("invalid repetition");
+                        }
+                        break;
+                    default: return node;
+                    }
+                    next();
+                    node = Node{ .m_kind = Node::Kind::REPEAT, .m_children = { std::move(node) }, .m_min = min, .m_max = max };
+                }
+                return node;
+            }
+
+            std::uint32_t number()
+            {
+                std::uint32_t value = 0;
+                if (done() || !isdigit(peek()))
+                {
+                    fail("expected number in repetition");
+                }
+                while (!done() && isdigit(peek()))
+                {
+                    value = value * 10 + (next() - '0');
+                    if (value > MAX_REPEAT)
+                    {
+                        fail(std::format("repetitions are limited to {}", MAX_REPEAT));
+                    }
+                }
+                return value;
+            }
+
+            Node atom()
+            {
+                auto ch = next();
+                switch (ch)
+                {
+                case '(':
+                    {
+                        m_depth++;
+                        auto group = alternation();
+                        m_depth--;
+                        if (done() || next() != ')')
+                        {
+                            fail("missing )");
+                        }
+                        return group;
+                    }
+                case '[': return bytes(bracket());
+                case '.': return bytes(ByteSet().set());
+                case '\\': return bytes(escape());
+                case '*':
+                case '+':
+                case '?':
+                case '{': fail(std::format("nothing to repeat before {}", ch));
+                case '^':
+                case '$': fail("anchors are only supported at the start and end of a pattern or of its alternatives");
+                default: return byte(ch);
+                }
+            }
+
+            ByteSet escape()
+            {
+                if (done())
+                {
+                    fail("trailing \\");
+                }
+
+                auto ch = next();
+                switch (ch)
+                {
+                case 'd': return byte_range('0', '9');
+                case 'D': return ~byte_range('0', '9');
+                case 'w': return byte_range('a', 'z') | byte_range('A', 'Z') | byte_range('0', '9') | byte_set('_');
+                case 'W': return ~(byte_range('a', 'z') | byte_range('A', 'Z') | byte_range('0', '9') | byte_set('_'));
+                case 's': return byte_range('\t', '\r') | byte_set(' ');
+                case 'S': return ~(byte_range('\t', '\r') | byte_set(' '));
+                default: return byte_set(ch);
+                }
+            }
+
+            ByteSet bracket()
+            {
+                bool negate = false;
+                if (!done() && (peek() == '^' || (m_glob && peek() == '!')))
+                {
+                    next();
+                    negate = true;
+                }
+
+                ByteSet set;
+                bool first = true;
+                while (true)
+                {
+                    if (done())
+                    {
+                        fail("missing ]");
+                    }
+
+                    auto ch = next();
+                    if (ch == ']' && !first)
+                    {
+                        break;
+                    }
+                    first = false;
+
+                    if (ch == '\\')
+                    {
+                        auto escaped = m_glob ? (done() ? ByteSet() : byte_set(next())) : escape();
+                        set |= escaped;
+                        continue;
+                    }
+
+                    if (m_pattern.size() - m_pos >= 2 && peek() == '-' && m_pattern[m_pos + 1] != ']')
+                    {
+                        next();
+                        auto last = next();
+                        if (static_cast<unsigned char>(last) < static_cast<unsigned char>(ch))
+                        {
+                            fail("invalid range");
+                        }
+                        set |= byte_range(ch, last);
+                    }
+                    else
+                    {
+                        set.set(static_cast<unsigned char>(ch));
+                    }
+                }
+                return negate ? ~set : set;
+            }
+
+        private:
+            std::string_view m_pattern;
+            std::size_t m_pos;
+
+            // groups the parser is in, anchors are only recognized outside of them
+            std::size_t m_depth;
+            bool m_glob;
+    };
+}
+
+NamePattern NamePattern::glob(std::string_view pattern)
+{
+    return NamePattern(Nfa(PatternParser(pattern, true).parse()));
+}
+
+NamePattern NamePattern::regex(std::string_view pattern)
+{
+    return NamePattern(Nfa(PatternParser(pattern, false).parse()));
+}
+
+NamePattern::NamePattern(const Nfa& nfa)
+{
+    // bytes belong to the same class when every byte set of the automaton either contains all or none of them
+    std::vector<const ByteSet*> sets;
+    for (const auto& state : nfa.m_states)
+    {
+        if (state.m_next >= 0)
+        {
+            sets.emplace_back(&state.m_bytes);
+        }
+    }
+
+    std::map<std::vector<bool>, std::uint8_t> signatures;
+    std::vector<unsigned char> representatives;
+    for (unsigned ch = 0; ch < 256; ch++)
+    {
+        std::vector<bool> signature(sets.size());
+        for (std::size_t i = 0; i < sets.size(); i++)
+        {
+            signature[i] = sets[i]->test(ch);
+        }
+
+        auto [it, inserted] = signatures.try_emplace(std::move(signature), representatives.size());
+        if (inserted)
+        {
+            representatives.emplace_back(ch);
+        }
+        m_classes[ch] = it->second;
+    }
+    m_n_classes = representatives.size();
+
+    auto closure = [&](std::vector<std::uint32_t> states) {
+        std::vector<char> seen(nfa.m_states.size(), false);
+        for (auto state : states)
+        {
+            seen[state] = true;
+        }
+        for (std::size_t i = 0; i < states.size(); i++)
+        {
+            for (auto next : nfa.m_states[states[i]].m_epsilon)
+            {
+                if (!seen[next])
+                {
+                    seen[next] = true;
+                    states.emplace_back(next);
+                }
+            }
+        }
+        std::sort(states.begin(), states.end());
+        return states;
+    };
+
+    // subset construction, with the empty set as the dead state
+    std::vector<std::vector<std::uint32_t>> subsets = { {}, closure({ nfa.m_start }) };
+    std::map<std::vector<std::uint32_t>, std::uint32_t> ids = { { subsets[DEAD_STATE], DEAD_STATE }, { subsets[START_STATE], START_STATE } };
+
+    for (std::size_t state = 0; state < subsets.size(); state++)
+    {
+        m_accepting.emplace_back(std::binary_search(subsets[state].begin(), subsets[state].end(), nfa.m_accept));
+        for (std::uint32_t byte_class = 0; byte_class < m_n_classes; byte_class++)
+        {
+            std::vector<std::uint32_t> targets;
+            for (auto nfa_state : subsets[state])
+            {
+                const auto& current = nfa.m_states[nfa_state];
+                if (current.m_next >= 0 && current.m_bytes.test(representatives[byte_class]))
+                {
+                    targets.emplace_back(current.m_next);
+                }
+            }
+
+            auto subset = closure(std::move(targets));
+            auto [it, inserted] = ids.try_emplace(subset, subsets.size());
+            if (inserted)
+            {
+                if (subsets.size() >= MAX_STATES)
+                {
+                    throw std::runtime_error("compilation error: pattern is too complex");
+                }
+                subsets.emplace_back(std::move(subset));
+            }
+            m_transitions.emplace_back(it->second);
+        }
+    }
+}
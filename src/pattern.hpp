@@ -0,0 +1,51 @@
+#ifndef PATTERN_HPP
+#define PATTERN_HPP
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// deterministic automaton compiled from a glob or a regular expression. matching follows a single
+// table entry per byte of the name, so it runs in linear time without allocating or backtracking.
+class NamePattern
+{
+    public:
+        // shell style glob (*, ? and [...] classes) that has to match the whole name
+        static NamePattern glob(std::string_view pattern);
+
+        // extended regular expression (|, *, +, ?, {m,n}, groups, classes, . and the \d \w \s
+        // escapes) that may match anywhere in the name unless anchored with ^ or $, which apply to the
+        // top-level alternative they are part of
+        static NamePattern regex(std::string_view pattern);
+
+        // internal representation of a pattern while it is compiled
+        struct Node;
+        struct Nfa;
+
+        bool matches(std::string_view name) const
+        {
+            std::uint32_t state = START_STATE;
+            for (unsigned char ch : name)
+            {
+                state = m_transitions[state * m_n_classes + m_classes[ch]];
+            }
+            return m_accepting[state];
+        };
+
+    private:
+        NamePattern(const Nfa& nfa);
+
+    private:
+        static constexpr std::uint32_t DEAD_STATE = 0;
+        static constexpr std::uint32_t START_STATE = 1;
+
+        // bytes that no part of the pattern tells apart share a class, which keeps the table small
+        std::array<std::uint8_t, 256> m_classes;
+        std::uint32_t m_n_classes;
+
+        std::vector<std::uint32_t> m_transitions;
+        std::vector<char> m_accepting;
+};
+
+#endif
@@ -1,375 +1,2155 @@
 #include "runtime.hpp"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <format>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <semaphore>
+#include <system_error>
 #include <thread>
+#include <unordered_map>
+#include <unistd.h>
+
+#include "hash.hpp"
+#include "io_scheduler.hpp"
+#include "manifest.hpp"
+#include "metrics.hpp"
+#include "ordered_output.hpp"
+#include "thread_pool.hpp"
 
 namespace fs = std::filesystem;
 
-std::string unique_filename(const std::string& filename, const fs::path& destination_path)
+// device an entry lives on for the i/o scheduler. an entry that cannot be stat'ed is charged to device 0,
+// and the operation on it reports the error itself.
+std::uint64_t device_of(Entry& entry)
+{
+    try
+    {
+        return entry.metadata().m_device;
+    }
+    catch(const fs::filesystem_error& e)
+    {
+        return 0;
+    }
+}
+
+// device a destination is written to. a destination that does not exist yet is charged to the device of
+// the closest directory above it that does.
+std::uint64_t destination_device_of(const fs::path& destination)
+{
+    for (auto path = destination;; path = path.parent_path())
+    {
+        Entry entry(path);
+        if (entry.exists() || path == path.parent_path())
+        {
+            return device_of(entry);
+        }
+    }
+}
+
+// entries read from a manifest may have changed since it was saved, and are left alone if they have
+bool still_saved(Entry& entry, SharedOutput& messages)
+{
+    if (entry.unchanged())
+    {
+        return true;
+    }
+    messages.print("skipping ", entry.path(), ", which changed since it was saved\n");
+    return false;
+}
+
+// reserved holds destinations that were handed out but may not exist yet
+std::string unique_filename(const std::string& filename, const fs::path& destination_path,
+    const std::unordered_set<fs::path>& reserved)
 {
     int duplicates = 0;
     std::string unique_filename = filename;
 
-    while (fs::exists(destination_path / unique_filename))
+    // a destination that cannot be stat'ed is handed out, and the operation on it reports the error itself
+    std::error_code error;
+    while (fs::exists(destination_path / unique_filename, error) || reserved.contains(destination_path / unique_filename))
     {
         unique_filename = filename + std::format(" ({})", ++duplicates);
     }
     return unique_filename;
 }
 
-void Cluster::execute(std::function<void(const fs::path& path)> operation)
+// picks a destination under destination_path for every selected entry of a batch, taking the lock once.
+// entries that are not selected get an empty destination.
+std::vector<fs::path> reserve_destinations(std::span<Entry> entries, const std::vector<char>& selected,
+    const fs::path& destination_path, std::unordered_set<fs::path>& reserved, std::mutex& mutex)
 {
-    std::vector<std::thread> threads;
+    std::vector<fs::path> destinations(entries.size());
 
-    for (const auto& path : m_paths)
+    std::lock_guard<std::mutex> guard(mutex);
+    for (std::size_t i = 0; i < entries.size(); i++)
     {
-        threads.emplace_back([&]() {
-            unpack(path, operation);
-        });
+        if (selected[i])
+        {
+            destinations[i] = destination_path / unique_filename(entries[i].path().filename(), destination_path, reserved);
+            reserved.insert(destinations[i]);
+        }
+    }
+    return destinations;
+}
+
+namespace
+{
+    // entries per batch for operations that favour throughput, and for display on a terminal where
+    // entries should show up as soon as they are found
+    constexpr std::size_t BATCH_SIZE = 256;
+    constexpr std::size_t SMALL_BATCH_SIZE = 1;
+
+    // entries a worker returned that were not handed to the operation yet. the paths are stored along
+    // with them, in vectors that are reserved up front so that the entries can refer to them.
+    class EntryBatch
+    {
+        public:
+            // whether the batch is full once entry is added
+            bool add(Entry& entry, std::size_t capacity)
+            {
+                if (m_paths.empty())
+                {
+                    m_paths.reserve(capacity);
+                    m_entries.reserve(capacity);
+                }
+                m_paths.emplace_back(entry.path());
+                m_entries.emplace_back(m_paths.back(), entry);
+                return m_entries.size() >= capacity;
+            };
+
+            bool empty() const { return m_entries.empty(); };
+
+            // the batch is emptied even when the operation throws, as the paths of the entries that are
+            // left would move once more are added
+            void hand_over(const BatchOperation& operation)
+            {
+                struct Clear
+                {
+                    EntryBatch& m_batch;
+
+                    ~Clear()
+                    {
+                        m_batch.m_entries.clear();
+                        m_batch.m_paths.clear();
+                    }
+                } clear{ *this };
+
+                Metrics::shared().add(Metrics::MATCHES, m_entries.size());
+                operation(m_entries);
+            };
+
+        private:
+            std::vector<fs::path> m_paths;
+            std::vector<Entry> m_entries;
+    };
+
+    struct AggregateRow
+    {
+        void add(std::uint64_t size)
+        {
+            m_count++;
+            m_total_size += size;
+            m_min_size = std::min(m_min_size, size);
+            m_max_size = std::max(m_max_size, size);
+        }
+
+        void merge(const AggregateRow& row)
+        {
+            m_count += row.m_count;
+            m_total_size += row.m_total_size;
+            m_min_size = std::min(m_min_size, row.m_min_size);
+            m_max_size = std::max(m_max_size, row.m_max_size);
+        }
+
+        std::uint64_t value(Aggregate aggregate) const
+        {
+            switch (aggregate)
+            {
+            case Aggregate::COUNT: return m_count;
+            case Aggregate::SUM_SIZE: return m_total_size;
+            case Aggregate::MIN_SIZE: return m_count ? m_min_size : 0;
+            case Aggregate::MAX_SIZE: return m_max_size;
+            default: std::unreachable();
+            }
+        }
+
+        std::uint64_t m_count = 0;
+        std::uint64_t m_total_size = 0;
+        std::uint64_t m_min_size = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t m_max_size = 0;
+    };
+
+    std::string group_of(const fs::path& path, GroupKey group_key)
+    {
+        switch (group_key)
+        {
+        case GroupKey::NONE: return {};
+        case GroupKey::EXTENSION: return path.extension().string();
+        case GroupKey::DIRECTORY: return path.parent_path().string();
+        default: std::unreachable();
+        }
+    }
+
+    std::string_view aggregate_name(Aggregate aggregate)
+    {
+        switch (aggregate)
+        {
+        case Aggregate::COUNT: return "count";
+        case Aggregate::SUM_SIZE: return "sum(size)";
+        case Aggregate::MIN_SIZE: return "min(size)";
+        case Aggregate::MAX_SIZE: return "max(size)";
+        default: std::unreachable();
+        }
+    }
+}
+
+namespace
+{
+    bool writes_file_system(InstrType type)
+    {
+        switch (type)
+        {
+        case InstrType::DELETE:
+        case InstrType::COPY:
+        case InstrType::MOVE:
+        case InstrType::SYNC:
+        case InstrType::SAVE:
+            return true;
+        default:
+            return false;
+        }
     }
+}
 
-    for (auto& thread : threads)
+bool Cluster::has_overlapping_inputs() const
+{
+    if (m_paths.size() + m_children.size() > 1)
     {
-        thread.join();
+        return true;
     }
+    return std::any_of(m_children.begin(), m_children.end(), [](const std::shared_ptr<Cluster>& child) {
+        return child->has_overlapping_inputs();
+    });
+}
 
+void Cluster::set_stop_token(std::stop_token stop_token)
+{
+    m_stop_token = stop_token;
     for (const auto& child : m_children)
     {
-        child->execute(operation);
+        child->set_stop_token(stop_token);
     }
 }
 
-void Cluster::unpack(const fs::path& path, std::function<void(const fs::path& path)> operation)
+void Cluster::execute(const Operation& operation)
 {
-    try
+    TaskGroup group;
+    for (const auto& path : m_paths)
+    {
+        group.submit([&]() {
+            if (!stopped())
+            {
+                Entry entry(path);
+                unpack(entry, operation);
+            }
+        });
+    }
+    group.wait();
+
+    for (const auto& child : m_children)
     {
-        if (m_parent)
+        if (stopped())
         {
-            if (fs::is_directory(path))
+            break;
+        }
+        child->execute(operation);
+    }
+}
+
+void Cluster::execute_batched(const BatchOperation& operation, std::size_t batch_size)
+{
+    PerWorker<EntryBatch> batches;
+    execute([&](Entry& entry) {
+        batches.update([&](EntryBatch& batch) {
+            if (batch.add(entry, batch_size))
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
+                batch.hand_over(operation);
+            }
+        });
+    });
+
+    // the batches that did not fill up are handed over once every worker is done
+    batches.for_each([&](EntryBatch& batch) {
+        if (!batch.empty())
+        {
+            batch.hand_over(operation);
+        }
+    });
+}
+
+VisitedSet::Claim Cluster::claim_directory(const fs::path& directory, std::uint64_t depth)
+{
+    Entry entry(directory);
+    const auto& metadata = entry.metadata();
+    return m_visited->claim(metadata.m_device, metadata.m_inode, depth);
+}
+
+std::shared_ptr<const DirectoryListing> Cluster::list_directory(const fs::path& directory)
+{
+    auto listing = m_cache ? m_cache->list(directory) : read_directory(directory);
+    Metrics::shared().add(Metrics::DIRECTORIES);
+    Metrics::shared().add(Metrics::ENTRIES, listing->m_entries.size());
+    return listing;
+}
+
+void Cluster::emit(Entry& entry, const Operation& operation)
+{
+    if (m_parent)
+    {
+        m_parent->unpack(entry, operation);
+    }
+    else
+    {
+        operation(entry);
+    }
+}
+
+template<typename Visit>
+void Cluster::visit_entries(const std::shared_ptr<const DirectoryListing>& listing, Visit visit)
+{
+    constexpr std::size_t CHUNK_SIZE = 16;
+
+    auto& entries = listing->m_entries;
+    auto n_inline = entries.size();
+
+    // excluded entries are dropped on their name alone, before anything is stat'ed or opened
+    auto included = [traversal = m_traversal](const fs::directory_entry& entry) {
+        return !traversal || traversal->m_excluded.empty() || !traversal->excludes(filename_of(entry.path()));
+    };
+
+    // when the rule is expensive enough to outweigh scheduling, the entries of a directory are spread
+    // over the pool instead of being evaluated by the task that listed them
+    auto group = TaskGroup::current();
+    if (group && m_rule && m_rule->m_cost >= CONTENT_COST && entries.size() > CHUNK_SIZE)
+    {
+        for (auto begin = CHUNK_SIZE; begin < entries.size(); begin += CHUNK_SIZE)
+        {
+            group->submit([this, listing, visit, included, begin]() {
+                auto end = std::min(begin + CHUNK_SIZE, listing->m_entries.size());
+                for (auto i = begin; i < end && !stopped(); i++)
                 {
-                    if (!m_rule || (*m_rule)(nested_path))
+                    try
                     {
-                        m_parent->unpack(nested_path, operation);
+                        if (included(listing->m_entries[i]))
+                        {
+                            visit(listing->m_entries[i], i);
+                        }
+                    }
+                    catch(const std::exception& e)
+                    {
+                        m_messages->print("could not unpack for: ", listing->m_entries[i].path(), "\n", e.what(), "\n");
                     }
                 }
+            });
+        }
+        n_inline = CHUNK_SIZE;
+    }
+
+    for (std::size_t i = 0; i < n_inline && !stopped(); i++)
+    {
+        if (included(entries[i]))
+        {
+            visit(entries[i], i);
+        }
+    }
+}
+
+void Cluster::unpack(Entry& entry, const Operation& operation)
+{
+    if (!m_rule || (*m_rule)(entry))
+    {
+        emit(entry, operation);
+    }
+}
+
+namespace
+{
+    template<Selection Kind>
+    constexpr const char* unpack_error()
+    {
+        switch (Kind)
+        {
+        case Selection::FILES: return "could not unpack files for: ";
+        case Selection::DIRECTORIES: return "could not unpack directories for: ";
+        case Selection::RECURSIVE: return "could not unpack recursively for: ";
+        default: return "could not unpack for: ";
+        }
+    }
+}
+
+template<Selection Kind>
+RuleMode SelectCluster<Kind>::rule_mode() const
+{
+    if (!m_rule)
+    {
+        return RuleMode::NONE;
+    }
+    return m_rule->m_block_function ? RuleMode::BLOCK : RuleMode::ENTRY;
+}
+
+template<Selection Kind>
+void SelectCluster<Kind>::specialize()
+{
+    static constexpr Kernel kernels[2][3] = {
+        { &SelectCluster::kernel<false, RuleMode::NONE>, &SelectCluster::kernel<false, RuleMode::ENTRY>,
+            &SelectCluster::kernel<false, RuleMode::BLOCK> },
+        { &SelectCluster::kernel<true, RuleMode::NONE>, &SelectCluster::kernel<true, RuleMode::ENTRY>,
+            &SelectCluster::kernel<true, RuleMode::BLOCK> },
+    };
+    m_kernel = kernels[m_parent != nullptr][static_cast<int>(rule_mode())];
+}
+
+template<Selection Kind>
+template<bool HasParent, RuleMode Rule>
+void SelectCluster<Kind>::kernel(Entry& entry, const Operation& operation)
+{
+    try
+    {
+        if (entry.is_directory())
+        {
+            if constexpr (Kind == Selection::RECURSIVE)
+            {
+                walk<HasParent, Rule>(entry.path(), 1, operation);
             }
             else
             {
-                if (!m_rule || (*m_rule)(path))
-                {
-                    m_parent->unpack(path, operation);
-                }
+                auto listing = list_directory(entry.path());
+                visit_entries(listing, [&, selection = select_names<Rule>(*listing)](const fs::directory_entry& listed, std::size_t index) {
+                    Entry nested_entry(listed);
+                    if constexpr (Kind == Selection::FILES)
+                    {
+                        if (!nested_entry.is_regular_file())
+                        {
+                            return;
+                        }
+                    }
+                    else if constexpr (Kind == Selection::DIRECTORIES)
+                    {
+                        if (!nested_entry.is_directory())
+                        {
+                            return;
+                        }
+                    }
+
+                    if (listed_matches<Rule>(nested_entry, selection, index))
+                    {
+                        emit_to<HasParent>(nested_entry, operation);
+                    }
+                });
             }
         }
-        else
+        else if constexpr (Kind != Selection::DIRECTORIES)
+        {
+            // a path that is not a directory stands for itself
+            if (matches<Rule>(entry))
+            {
+                emit_to<HasParent>(entry, operation);
+            }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        m_messages->print(unpack_error<Kind>(), entry.path(), "\n", e.what(), "\n");
+    }
+}
+
+template<Selection Kind>
+template<bool HasParent, RuleMode Rule>
+void SelectCluster<Kind>::walk(const fs::path& directory, std::uint64_t depth, const Operation& operation)
+{
+    auto max_depth = m_traversal ? m_traversal->m_max_depth : std::numeric_limits<std::uint64_t>::max();
+    bool limited = max_depth != std::numeric_limits<std::uint64_t>::max();
+    bool follow_symlinks = m_visited != nullptr;
+
+    // subdirectories are handed to the pool so a single deep root still uses every worker. outside of the
+    // pool they wait on an explicit stack, so that a deep tree cannot overflow the call stack.
+    auto group = TaskGroup::current();
+    std::vector<std::pair<fs::path, std::uint64_t>> pending;
+    pending.emplace_back(directory, depth);
+
+    // subdirectories queued before a stop still reach here, but are not listed anymore
+    while (!pending.empty() && !stopped())
+    {
+        auto [current, current_depth] = std::move(pending.back());
+        pending.pop_back();
+        if (current_depth > max_depth)
         {
-            if (fs::is_directory(path))
+            continue;
+        }
+
+        // a directory that cannot be listed is reported on its own, and the rest of the tree is still walked.
+        // the visit may run on other workers after this iteration, so it captures what it needs by value.
+        try
+        {
+            // with links followed, the files of a directory reached through several of them are returned by the
+            // first only. under a depth limit, a later visit from higher up the tree still descends, so that
+            // which subdirectories are reached does not depend on the order the workers got to the aliases.
+            bool first_visit = true;
+            if (follow_symlinks)
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
+                auto claim = claim_directory(current, limited ? current_depth : 0);
+                if (claim == VisitedSet::Claim::TAKEN || (claim == VisitedSet::Claim::SHALLOWER && current_depth >= max_depth))
+                {
+                    continue;
+                }
+                first_visit = claim == VisitedSet::Claim::FIRST;
+            }
+
+            auto listing = list_directory(current);
+            visit_entries(listing, [this, &operation, &pending, group, max_depth, follow_symlinks, first_visit, depth = current_depth,
+                selection = select_names<Rule>(*listing)](const fs::directory_entry& nested_path, std::size_t index) {
+                if ((follow_symlinks || !nested_path.is_symlink()) && nested_path.is_directory())
+                {
+                    // the entries of a subdirectory past the depth limit could never be returned
+                    if (depth >= max_depth)
+                    {
+                        return;
+                    }
+
+                    if (group)
+                    {
+                        group->submit([this, directory = nested_path.path(), depth, &operation]() {
+                            walk<HasParent, Rule>(directory, depth + 1, operation);
+                        });
+                    }
+                    else
+                    {
+                        pending.emplace_back(nested_path.path(), depth + 1);
+                    }
+                }
+                else if (first_visit)
                 {
-                    if (!m_rule || (*m_rule)(nested_path))
+                    Entry nested_entry(nested_path);
+                    if (nested_entry.is_regular_file() && listed_matches<Rule>(nested_entry, selection, index))
                     {
-                        operation(nested_path);
+                        emit_to<HasParent>(nested_entry, operation);
                     }
                 }
-            }
-            else
+            });
+        }
+        catch(const std::exception& e)
+        {
+            m_messages->print(unpack_error<Kind>(), current, "\n", e.what(), "\n");
+        }
+    }
+}
+
+template<Selection Kind>
+Estimate SelectCluster<Kind>::estimate(const Approximation& approximation, bool needs_size) requires (Kind == Selection::RECURSIVE)
+{
+    constexpr std::uint64_t MIN_PROBES = 64;
+    constexpr std::uint64_t PROBES_PER_TASK = 16;
+
+    // when matches are rare, all probes so far can miss them and agree on an estimate of 0±0
+    constexpr std::uint64_t MIN_HITS = 16;
+    constexpr double Z_95 = 1.96;
+
+    auto deadline = std::chrono::steady_clock::now() + approximation.m_budget;
+    auto max_depth = m_traversal ? m_traversal->m_max_depth : std::numeric_limits<std::uint64_t>::max();
+
+    auto included = [this](const fs::directory_entry& entry) {
+        return !m_traversal || m_traversal->m_excluded.empty() || !m_traversal->excludes(filename_of(entry.path()));
+    };
+    auto selected = [this](Entry& entry) {
+        return !m_rule || (*m_rule)(entry);
+    };
+
+    // paths that are not directories stand for themselves and are counted exactly
+    Estimate estimate;
+    std::vector<fs::path> directories;
+    for (const auto& path : m_paths)
+    {
+        try
+        {
+            Entry entry(path);
+            if (entry.is_directory())
             {
-                if (!m_rule || (*m_rule)(path))
+                if (max_depth > 0 && (!m_visited || claim_directory(path) == VisitedSet::Claim::FIRST))
                 {
-                    operation(path);
+                    directories.emplace_back(path);
                 }
             }
+            else if (selected(entry))
+            {
+                estimate.m_count++;
+                estimate.m_size += needs_size ? entry.metadata().m_size : 0;
+            }
+        }
+        catch(const std::exception& e)
+        {
+            m_messages->print(unpack_error<Kind>(), path, "\n", e.what(), "\n");
         }
     }
-    catch(const std::exception& e)
+    if (directories.empty())
     {
-        std::cout << "could not unpack for: " << path << "\n" << e.what() << "\n";
+        return estimate;
     }
-}
 
-void RecursiveCluster::unpack(const fs::path& path, std::function<void(const fs::path& path)> operation)
-{
-    try
+    // what a directory adds to a probe before it is weighed, and where the probe can go on from there.
+    // probes keep passing through the directories near the roots, which are only read once.
+    struct Summary
     {
-        if (m_parent)
+        double m_count = 0;
+        double m_size = 0;
+        std::vector<fs::path> m_subdirectories;
+    };
+
+    std::mutex summaries_mutex;
+    std::unordered_map<fs::path, std::shared_ptr<const Summary>> summaries;
+    auto summarize = [&](const fs::path& directory) {
+        {
+            std::lock_guard<std::mutex> guard(summaries_mutex);
+            if (auto it = summaries.find(directory); it != summaries.end())
+            {
+                return it->second;
+            }
+        }
+
+        auto summary = std::make_shared<Summary>();
+        try
+        {
+            auto listing = list_directory(directory);
+            for (const auto& nested_path : listing->m_entries)
+            {
+                if (!included(nested_path))
+                {
+                    continue;
+                }
+
+                // a probe only passes through a directory from the first directory found to lead to it, which
+                // keeps links from forming cycles
+                if ((m_visited || !nested_path.is_symlink()) && nested_path.is_directory())
+                {
+                    if (!m_visited || claim_directory(nested_path.path()) == VisitedSet::Claim::FIRST)
+                    {
+                        summary->m_subdirectories.emplace_back(nested_path.path());
+                    }
+                    continue;
+                }
+
+                Entry nested_entry(nested_path);
+                if (nested_entry.is_regular_file() && selected(nested_entry))
+                {
+                    summary->m_count++;
+                    summary->m_size += needs_size ? nested_entry.metadata().m_size : 0;
+                }
+            }
+        }
+        catch(const std::exception& e)
         {
-            if (fs::is_directory(path))
+            m_messages->print(unpack_error<Kind>(), directory, "\n", e.what(), "\n");
+        }
+
+        std::lock_guard<std::mutex> guard(summaries_mutex);
+        return summaries.try_emplace(directory, std::move(summary)).first->second;
+    };
+
+    auto probe = [&](std::mt19937_64& random) {
+        auto pick = [&](std::size_t n) { return std::uniform_int_distribution<std::size_t>(0, n - 1)(random); };
+
+        double weight = directories.size();
+        auto summary = summarize(directories[pick(directories.size())]);
+        std::pair<double, double> found;
+        for (std::uint64_t depth = 1;; depth++)
+        {
+            found.first += weight * summary->m_count;
+            found.second += weight * summary->m_size;
+            if (summary->m_subdirectories.empty() || depth >= max_depth)
+            {
+                return found;
+            }
+            weight *= summary->m_subdirectories.size();
+            summary = summarize(summary->m_subdirectories[pick(summary->m_subdirectories.size())]);
+        }
+    };
+
+    // running means and sums of squared deviations of the probes (Welford)
+    std::uint64_t n_probes = 0, n_hits = 0;
+    double mean_count = 0, deviation_count = 0, mean_size = 0, deviation_size = 0;
+    auto half_width = [&](double deviation) {
+        return n_probes > 1 ? Z_95 * std::sqrt(deviation / (n_probes - 1) / n_probes) : std::numeric_limits<double>::infinity();
+    };
+
+    // probes are taken in rounds on every worker, and the estimate is checked after every round
+    while (!stopped())
+    {
+        std::mutex found_mutex;
+        std::vector<std::pair<double, double>> found;
+
+        TaskGroup group;
+        for (std::size_t task = 0; task < ThreadPool::shared().size(); task++)
+        {
+            group.submit([&]() {
+                thread_local std::mt19937_64 random(std::random_device{}());
+
+                std::vector<std::pair<double, double>> task_found;
+                for (std::uint64_t i = 0; i < PROBES_PER_TASK && !stopped(); i++)
+                {
+                    task_found.emplace_back(probe(random));
+                    if (std::chrono::steady_clock::now() >= deadline)
+                    {
+                        break;
+                    }
+                }
+
+                std::lock_guard<std::mutex> guard(found_mutex);
+                found.insert(found.end(), task_found.begin(), task_found.end());
+            });
+        }
+        group.wait();
+
+        for (const auto& [count, size] : found)
+        {
+            n_probes++;
+            n_hits += count > 0;
+            auto count_delta = count - mean_count;
+            mean_count += count_delta / n_probes;
+            deviation_count += count_delta * (count - mean_count);
+            auto size_delta = size - mean_size;
+            mean_size += size_delta / n_probes;
+            deviation_size += size_delta * (size - mean_size);
+        }
+
+        bool converged = n_probes >= MIN_PROBES && n_hits >= MIN_HITS && half_width(deviation_count) <= approximation.m_error * mean_count &&
+            (!needs_size || half_width(deviation_size) <= approximation.m_error * mean_size);
+        if (converged || std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+    }
+
+    estimate.m_count += mean_count;
+    estimate.m_count_error = half_width(deviation_count);
+    estimate.m_size += mean_size;
+    estimate.m_size_error = half_width(deviation_size);
+    estimate.m_probes = n_probes;
+    estimate.m_hits = n_hits;
+    estimate.m_reliable = n_hits >= MIN_HITS;
+    return estimate;
+}
+
+void DuplicatesCluster::specialize()
+{
+    static constexpr Kernel kernels[3] = {
+        &DuplicatesCluster::kernel<false, RuleMode::NONE>, &DuplicatesCluster::kernel<false, RuleMode::ENTRY>,
+        &DuplicatesCluster::kernel<false, RuleMode::BLOCK>,
+    };
+    m_kernel = kernels[static_cast<int>(rule_mode())];
+}
+
+void DuplicatesCluster::collect(Entry& entry)
+{
+    // a symbolic link is not a copy of the file it points to, and deleting the file as the redundant one
+    // would leave the link dangling, so only entries that are regular files themselves are candidates
+    auto type = entry.known_type();
+    if (type == fs::file_type::none)
+    {
+        std::error_code error;
+        type = fs::symlink_status(entry.path(), error).type();
+    }
+    if (type != fs::file_type::regular)
+    {
+        return;
+    }
+
+    // empty files are not considered duplicates of each other
+    const auto& metadata = entry.metadata();
+    if (metadata.m_size > 0)
+    {
+        // the same file can be reached through overlapping paths or child clusters
+        auto [path, inserted] = m_arena.intern(entry.path());
+        if (inserted)
+        {
+            m_candidates.update([&](std::vector<Candidate>& candidates) {
+                candidates.emplace_back(Candidate{ metadata.m_size, 0, metadata.m_device, metadata.m_inode, path });
+            });
+        }
+    }
+}
+
+void DuplicatesCluster::execute(const Operation& operation)
+{
+    // walking the paths and child clusters ends up in collect(), which only records candidates
+    Cluster::execute([this](Entry& entry) {
+        collect(entry);
+    });
+
+    std::vector<Candidate> candidates;
+    m_candidates.for_each([&](std::vector<Candidate>& worker_candidates) {
+        std::move(worker_candidates.begin(), worker_candidates.end(), std::back_inserter(candidates));
+        worker_candidates.clear();
+    });
+
+    // files can only be identical when their sizes are, then when their edges are and finally when
+    // their whole contents are. only files that still collide after a stage are read by the next.
+    drop_hard_links(candidates);
+    retain_collisions(candidates);
+
+    digest_candidates(candidates, [this](Candidate& candidate) {
+        candidate.m_digest = hash_file_edges(m_arena.path(candidate.m_path), candidate.m_size, EDGE_SIZE);
+    });
+    retain_collisions(candidates);
+
+    // the edges already cover the whole contents of small files
+    digest_candidates(candidates, [this](Candidate& candidate) {
+        if (candidate.m_size > 2 * EDGE_SIZE)
+        {
+            candidate.m_digest = hash_file(m_arena.path(candidate.m_path));
+        }
+    });
+    retain_collisions(candidates);
+
+    // equal digests still leave a chance of a collision, so every member of a group is compared byte by
+    // byte with the path that is kept, which is the first one in lexicographic order. members that differ
+    // from it can still be identical to each other and are compared again among themselves.
+    // the comparisons hold two descriptors at a time and run on this thread only, so they cannot starve
+    // each other of the descriptor budget
+    auto identical = [](const fs::path& lhs, const fs::path& rhs, std::uint64_t size) {
+        try
+        {
+            return files_equal(lhs, rhs, size);
+        }
+        catch(const std::exception& e)
+        {
+            return false;
+        }
+    };
+
+    std::vector<fs::path> group;
+    std::vector<fs::path> differing;
+    for (std::size_t begin = 0, end; begin < candidates.size() && !stopped(); begin = end)
+    {
+        auto size = candidates[begin].m_size;
+        group.clear();
+        for (end = begin; end < candidates.size() && same_contents(candidates[begin], candidates[end]); end++)
+        {
+            group.emplace_back(m_arena.path(candidates[end].m_path));
+        }
+        std::sort(group.begin(), group.end());
+
+        while (group.size() > 1 && !stopped())
+        {
+            differing.clear();
+            for (std::size_t i = 1; i < group.size() && !stopped(); i++)
+            {
+                if (identical(group.front(), group[i], size))
+                {
+                    Entry entry(group[i]);
+                    emit(entry, operation);
+                }
+                else
+                {
+                    differing.emplace_back(std::move(group[i]));
+                }
+            }
+            std::swap(group, differing);
+        }
+    }
+}
+
+void DuplicatesCluster::drop_hard_links(std::vector<Candidate>& candidates) const
+{
+    auto key = [](const Candidate& candidate) {
+        return std::tie(candidate.m_device, candidate.m_inode);
+    };
+
+    std::sort(candidates.begin(), candidates.end(), [&](const Candidate& lhs, const Candidate& rhs) {
+        if (key(lhs) != key(rhs))
+        {
+            return key(lhs) < key(rhs);
+        }
+        return m_arena.path(lhs.m_path) < m_arena.path(rhs.m_path);
+    });
+    candidates.erase(std::unique(candidates.begin(), candidates.end(), [&](const Candidate& lhs, const Candidate& rhs) {
+        return key(lhs) == key(rhs);
+    }), candidates.end());
+}
+
+bool DuplicatesCluster::same_contents(const Candidate& lhs, const Candidate& rhs)
+{
+    return lhs.m_size == rhs.m_size && lhs.m_digest == rhs.m_digest;
+}
+
+void DuplicatesCluster::retain_collisions(std::vector<Candidate>& candidates)
+{
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& lhs, const Candidate& rhs) {
+        return std::tie(lhs.m_size, lhs.m_digest) < std::tie(rhs.m_size, rhs.m_digest);
+    });
+
+    std::vector<Candidate> collisions;
+    for (std::size_t begin = 0, end; begin < candidates.size(); begin = end)
+    {
+        for (end = begin + 1; end < candidates.size() && same_contents(candidates[begin], candidates[end]); end++);
+        if (end - begin > 1)
+        {
+            std::move(candidates.begin() + begin, candidates.begin() + end, std::back_inserter(collisions));
+        }
+    }
+    candidates = std::move(collisions);
+}
+
+template<typename Digest>
+void DuplicatesCluster::digest_candidates(std::vector<Candidate>& candidates, Digest digest)
+{
+    constexpr std::size_t CHUNK_SIZE = 32;
+
+    std::vector<char> unreadable(candidates.size(), false);
+    TaskGroup group;
+    for (std::size_t begin = 0; begin < candidates.size(); begin += CHUNK_SIZE)
+    {
+        group.submit([&, begin]() {
+            auto end = std::min(begin + CHUNK_SIZE, candidates.size());
+            for (auto i = begin; i < end; i++)
+            {
+                try
+                {
+                    digest(candidates[i]);
+                }
+                catch(const std::exception& e)
+                {
+                    unreadable[i] = true;
+                }
+            }
+        });
+    }
+    group.wait();
+
+    // files that could not be read are never reported as duplicates
+    std::size_t n_readable = 0;
+    for (std::size_t i = 0; i < candidates.size(); i++)
+    {
+        if (!unreadable[i])
+        {
+            candidates[n_readable++] = std::move(candidates[i]);
+        }
+    }
+    candidates.resize(n_readable);
+}
+
+void ManifestCluster::execute(const Operation& operation)
+{
+    constexpr std::size_t CHUNK_SIZE = 256;
+
+    for (const auto& path : m_paths)
+    {
+        if (!fs::exists(path))
+        {
+            throw std::runtime_error(std::format("runtime error: manifest {} does not exist", path.string()));
+        }
+        manifest::Reader reader(path);
+
+        TaskGroup group;
+        for (std::size_t begin = 0; begin < reader.size(); begin += CHUNK_SIZE)
+        {
+            group.submit([&, begin]() {
+                auto end = std::min(begin + CHUNK_SIZE, reader.size());
+                for (auto i = begin; i < end && !stopped(); i++)
+                {
+                    fs::path entry_path = reader.path(i);
+                    Entry entry(entry_path, reader.metadata(i));
+                    emit(entry, operation);
+                }
+            });
+        }
+        group.wait();
+    }
+}
+
+void StreamCluster::execute(const Operation& operation)
+{
+    constexpr std::size_t BATCH_SIZE = 256;
+
+    // batches are handed to the pool as soon as they are read. the reader waits when too many are
+    // pending, so a fast input does not pile up in memory.
+    TaskGroup group;
+    std::counting_semaphore<> pending(4 * ThreadPool::shared().size());
+    auto submit = [&](std::vector<fs::path>&& batch) {
+        pending.acquire();
+        group.submit([this, &operation, &pending, batch = std::move(batch)]() {
+            // the slot is given back even when the batch throws, or the reader would wait for it forever
+            struct Release
+            {
+                std::counting_semaphore<>& m_pending;
+
+                ~Release() { m_pending.release(); }
+            } release{ pending };
+
+            for (const auto& path : batch)
+            {
+                if (stopped())
+                {
+                    break;
+                }
+
+                Entry entry(path);
+                if (entry.exists())
+                {
+                    emit(entry, operation);
+                }
+                else
+                {
+                    m_messages->print("could not find: ", path, "\n");
+                }
+            }
+        });
+    };
+
+    // whichever of a newline or a NUL ends the first path delimits all of them, so the output of
+    // find -print0 or git ls-files -z can be read as is
+    char delimiter = '\n';
+    std::string path;
+    for (int ch; (ch = m_input.get()) != std::char_traits<char>::eof();)
+    {
+        if (ch == '\n' || ch == '\0')
+        {
+            delimiter = ch;
+            break;
+        }
+        path += static_cast<char>(ch);
+    }
+
+    std::vector<fs::path> batch;
+    do
+    {
+        if (!path.empty())
+        {
+            batch.emplace_back(std::move(path));
+        }
+        if (batch.size() >= BATCH_SIZE)
+        {
+            submit(std::move(batch));
+            batch.clear();
+        }
+    } while (!stopped() && std::getline(m_input, path, delimiter));
+
+    if (!batch.empty())
+    {
+        submit(std::move(batch));
+    }
+    group.wait();
+}
+
+void* Runtime::stack_pop()
+{
+    if (m_operand_sp > 0)
+    {
+        return m_operand_stack[--m_operand_sp];
+    }
+    throw std::runtime_error("runtime error: stack underflow");
+}
+
+void Runtime::stack_push(void* operand)
+{
+    if (m_operand_sp < m_operand_stack.size())
+    {
+        m_operand_stack[m_operand_sp++] = operand;
+    }
+    else
+    {
+        throw std::runtime_error("runtime error: stack overflow");
+    }
+}
+
+void Runtime::create_cluster(std::uint64_t n_paths)
+{
+    if (m_cluster_sp < m_cluster_stack.size())
+    {
+        std::shared_ptr<Cluster> cluster = nullptr;
+
+        auto select_specifier = reinterpret_cast<std::uint64_t>(stack_pop());
+        switch (select_specifier)
+        {
+        case 0b11:
+            cluster = std::make_shared<AllCluster>();
+            break;
+        case 0b10:
+            cluster = std::make_shared<DirectoriesCluster>();
+            break;
+        case 0b01:
+            cluster = std::make_shared<FilesCluster>();
+            break;
+        case 0b00:
+            cluster = std::make_shared<RecursiveCluster>();
+            break;
+        case 0b100:
+            cluster = std::make_shared<DuplicatesCluster>();
+            break;
+        case 0b1000:
+            cluster = std::make_shared<ManifestCluster>();
+            break;
+        case 0b10000:
+            if (!m_paths_input)
+            {
+                throw std::runtime_error("runtime error: no input to read paths from, use --paths-from <file>");
+            }
+            cluster = std::make_shared<StreamCluster>(*m_paths_input);
+            break;
+        default: std::unreachable();
+        }
+
+        cluster->m_cache = m_cache;
+        cluster->m_messages = &m_messages;
+        cluster->m_traversal = reinterpret_cast<Traversal*>(stack_pop());
+        if (cluster->m_traversal && cluster->m_traversal->m_follow_symlinks)
+        {
+            cluster->m_visited = std::make_unique<VisitedSet>();
+        }
+        cluster->m_rule = reinterpret_cast<Predicate*>(stack_pop());
+        cluster->specialize();
+
+        for (; n_paths > 0; n_paths--)
+        {
+            auto element = *reinterpret_cast<fs::path*>(stack_pop());
+            cluster->m_paths.emplace_back(element);
+        }
+        m_cluster_stack[m_cluster_sp++] = cluster;
+    }
+    else
+    {
+        throw std::runtime_error("runtime error: stack overflow");
+    }
+}
+
+void Runtime::merge_clusters(std::uint64_t n_clusters)
+{
+    if ((m_cluster_sp - static_cast<std::int64_t>(n_clusters)) >= 0)
+    {
+        auto parent = m_cluster_stack[--m_cluster_sp];
+        for (; n_clusters > 0; n_clusters--)
+        {
+            auto child = m_cluster_stack[--m_cluster_sp];
+            child->m_parent = parent;
+            child->specialize();
+            parent->m_children.emplace_back(child);
+        }
+        m_cluster_stack[m_cluster_sp++] = parent;
+    }
+    else
+    {
+        throw std::runtime_error("runtime error: stack underflow");
+    }
+}
+
+bool OrderedCluster::before(const Candidate& lhs, const Candidate& rhs) const
+{
+    // ties are broken by path so that the order does not depend on scheduling
+    if (m_ordering.m_descending)
+    {
+        return std::tie(rhs.m_rank, rhs.m_name, lhs.m_path) < std::tie(lhs.m_rank, lhs.m_name, rhs.m_path);
+    }
+    return std::tie(lhs.m_rank, lhs.m_name, lhs.m_path) < std::tie(rhs.m_rank, rhs.m_name, rhs.m_path);
+}
+
+void OrderedCluster::execute(const Operation& operation)
+{
+    auto before = [this](const Candidate& lhs, const Candidate& rhs) { return this->before(lhs, rhs); };
+
+    // a path reached through several inputs would otherwise take more than one place in a heap
+    PathArena paths;
+    bool overlapping = m_source->has_overlapping_inputs();
+
+    auto capacity = m_ordering.m_limit;
+    m_source->execute([&](Entry& entry) {
+        if (overlapping && !paths.intern(entry.path()).second)
+        {
+            return;
+        }
+
+        Candidate candidate{ 0, {}, entry.path() };
+        switch (m_ordering.m_key)
+        {
+        case OrderKey::SIZE:
+            candidate.m_rank = entry.metadata().m_size;
+            break;
+        case OrderKey::MODIFIED:
+            candidate.m_rank = entry.metadata().m_modified;
+            break;
+        case OrderKey::NAME:
+            candidate.m_name = entry.path().filename().string();
+            break;
+        }
+
+        // the top of each heap is the last of the entries kept so far
+        m_heaps.update([&](std::vector<Candidate>& heap) {
+            if (heap.size() < capacity)
+            {
+                heap.emplace_back(std::move(candidate));
+                std::push_heap(heap.begin(), heap.end(), before);
+            }
+            else if (capacity && before(candidate, heap.front()))
+            {
+                std::pop_heap(heap.begin(), heap.end(), before);
+                heap.back() = std::move(candidate);
+                std::push_heap(heap.begin(), heap.end(), before);
+            }
+        });
+    });
+
+    std::vector<Candidate> candidates;
+    m_heaps.for_each([&](std::vector<Candidate>& heap) {
+        std::move(heap.begin(), heap.end(), std::back_inserter(candidates));
+        heap.clear();
+    });
+
+    std::sort(candidates.begin(), candidates.end(), before);
+    if (candidates.size() > m_ordering.m_limit)
+    {
+        candidates.resize(m_ordering.m_limit);
+    }
+
+    for (const auto& candidate : candidates)
+    {
+        Entry entry(candidate.m_path);
+        operation(entry);
+    }
+}
+
+void Runtime::order_cluster(const Ordering& ordering)
+{
+    auto source = m_cluster_stack[--m_cluster_sp];
+    auto cluster = std::make_shared<OrderedCluster>(source, ordering);
+    cluster->m_cache = m_cache;
+    cluster->m_messages = &m_messages;
+    m_cluster_stack[m_cluster_sp++] = cluster;
+}
+
+void LimitedCluster::execute(const Operation& operation)
+{
+    if (!m_limit)
+    {
+        return;
+    }
+
+    // entries reached through several inputs are only counted once
+    PathArena paths;
+    bool overlapping = m_source->has_overlapping_inputs();
+
+    std::atomic<std::uint64_t> n_produced = 0;
+    m_source->set_stop_token(m_stop_source.get_token());
+    m_source->execute([&](Entry& entry) {
+        if (overlapping && !paths.intern(entry.path()).second)
+        {
+            return;
+        }
+
+        // workers that were already evaluating an entry when the stop was requested may still get here
+        auto index = n_produced.fetch_add(1, std::memory_order_relaxed);
+        if (index + 1 >= m_limit)
+        {
+            m_stop_source.request_stop();
+        }
+        if (index < m_limit)
+        {
+            operation(entry);
+        }
+    });
+}
+
+void Runtime::limit_cluster(std::uint64_t limit)
+{
+    auto source = m_cluster_stack[--m_cluster_sp];
+    auto cluster = std::make_shared<LimitedCluster>(source, limit);
+    cluster->m_cache = m_cache;
+    cluster->m_messages = &m_messages;
+    m_cluster_stack[m_cluster_sp++] = cluster;
+}
+
+void MemoizedCluster::execute(const Operation& operation)
+{
+    constexpr std::size_t CHUNK_SIZE = 256;
+
+    std::shared_ptr<const Memo::Recording> recording;
+    {
+        // queries of the script that run at the same time wait for the one that records
+        std::unique_lock<std::mutex> lock(m_memo.m_mutex);
+        m_memo.m_recorded.wait(lock, [this]() { return !m_memo.m_recording; });
+        if (m_memo.m_latest && m_memo.m_latest->m_generation == m_generation)
+        {
+            recording = m_memo.m_latest;
+        }
+        else
+        {
+            m_memo.m_recording = true;
+        }
+    }
+
+    if (recording)
+    {
+        TaskGroup group;
+        for (std::size_t begin = 0; begin < recording->m_results.size(); begin += CHUNK_SIZE)
+        {
+            group.submit([&, begin]() {
+                auto end = std::min(begin + CHUNK_SIZE, recording->m_results.size());
+                for (auto i = begin; i < end && !stopped(); i++)
+                {
+                    fs::path path = recording->m_paths.path(recording->m_results[i].m_path);
+                    Entry entry(path, recording->m_results[i].m_type);
+                    emit(entry, operation);
+                }
+            });
+        }
+        group.wait();
+        return;
+    }
+
+    auto recorded = std::make_shared<Memo::Recording>();
+    recorded->m_generation = m_generation;
+
+    PerWorker<std::vector<Memo::Result>> results;
+    auto record = [&]() {
+        m_children.front()->execute([&](Entry& entry) {
+            auto path = recorded->m_paths.intern(entry.path()).first;
+            results.update([&](std::vector<Memo::Result>& worker_results) {
+                worker_results.emplace_back(path, entry.known_type());
+            });
+            emit(entry, operation);
+        });
+    };
+
+    // whatever happens, the occurrences waiting for the recording have to go on
+    auto finish = [this](std::shared_ptr<const Memo::Recording> latest) {
+        {
+            std::lock_guard<std::mutex> guard(m_memo.m_mutex);
+            if (latest)
+            {
+                m_memo.m_latest = std::move(latest);
+            }
+            m_memo.m_recording = false;
+        }
+        m_memo.m_recorded.notify_all();
+    };
+
+    try
+    {
+        record();
+    }
+    catch(...)
+    {
+        finish(nullptr);
+        throw;
+    }
+
+    if (stopped())
+    {
+        finish(nullptr);
+        return;
+    }
+
+    results.for_each([&](std::vector<Memo::Result>& worker_results) {
+        recorded->m_results.insert(recorded->m_results.end(), worker_results.begin(), worker_results.end());
+    });
+    finish(std::move(recorded));
+}
+
+void Runtime::memoize_cluster(Memo& memo)
+{
+    auto source = m_cluster_stack[--m_cluster_sp];
+    auto cluster = std::make_shared<MemoizedCluster>(source, memo, m_generation->load());
+    cluster->m_cache = m_cache;
+    cluster->m_messages = &m_messages;
+    m_cluster_stack[m_cluster_sp++] = cluster;
+}
+
+void Runtime::display_operation()
+{
+    PathArena paths;
+
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        std::string lines;
+        for (auto& entry : entries)
+        {
+            if (paths.intern(entry.path()).second)
+            {
+                lines += entry.path().native();
+                lines += '\n';
+            }
+        }
+
+        m_messages.write(lines);
+    }, m_interactive ? SMALL_BATCH_SIZE : BATCH_SIZE);
+    m_output.flush();
+}
+
+void Runtime::delete_operation()
+{
+    if (m_journal)
+    {
+        journaled_operation(InstrType::DELETE, {});
+        return;
+    }
+
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        // an entry that cannot be deleted is reported, and the rest of the batch is still deleted
+        for (auto& entry : entries)
+        {
+            try
+            {
+                if (!still_saved(entry, m_messages))
+                {
+                    continue;
+                }
+
+                IoScheduler::shared().run(device_of(entry), 0, [&]() {
+                    fs::remove_all(entry.path()); // TODO: this seems to not be working for directories with files in it.
+                });
+            }
+            catch(const std::exception& e)
+            {
+                m_messages.print("could not delete: ", entry.path(), "\n", e.what(), "\n");
+            }
+        }
+    }, BATCH_SIZE);
+}
+
+void Runtime::move_operation(fs::path& destination_path)
+{
+    if (m_journal)
+    {
+        journaled_operation(InstrType::MOVE, destination_path);
+        return;
+    }
+
+    std::unordered_set<fs::path> destinations;
+    std::mutex mutex;
+
+    // the destinations of a batch are picked under one lock, the moves themselves are paced per device
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        std::vector<char> selected(entries.size());
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            selected[i] = still_saved(entries[i], m_messages);
+        }
+
+        auto targets = reserve_destinations(entries, selected, destination_path, destinations, mutex);
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            if (!selected[i])
+            {
+                continue;
+            }
+
+            try
+            {
+                IoScheduler::shared().run(device_of(entries[i]), 0, [&]() {
+                    fs::rename(entries[i].path(), targets[i]);
+                });
+            }
+            catch(const std::exception& e)
+            {
+                m_messages.print("could not move: ", entries[i].path(), "\n", e.what(), "\n");
+            }
+        }
+    }, BATCH_SIZE);
+}
+
+void Runtime::copy_operation(fs::path& destination_path)
+{
+    if (m_journal)
+    {
+        journaled_operation(InstrType::COPY, destination_path);
+        return;
+    }
+
+    PathArena paths;
+    std::unordered_set<fs::path> destinations;
+    std::mutex mutex;
+
+    // the destinations of a batch are picked under one lock, the copies themselves are paced on the
+    // devices they read from and write to
+    auto destination_device = destination_device_of(destination_path);
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        std::vector<char> selected(entries.size());
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            selected[i] = paths.intern(entries[i].path()).second && still_saved(entries[i], m_messages);
+        }
+
+        auto targets = reserve_destinations(entries, selected, destination_path, destinations, mutex);
+        for (std::size_t i = 0; i < entries.size(); i++)
+        {
+            if (!selected[i])
+            {
+                continue;
+            }
+
+            // a copied directory is charged as a single operation, its contents are not sized up front
+            auto& entry = entries[i];
+            try
+            {
+                auto n_bytes = entry.is_regular_file() ? entry.metadata().m_size : 0;
+                IoScheduler::shared().run(device_of(entry), destination_device, n_bytes, [&]() {
+                    fs::copy(entry.path(), targets[i], fs::copy_options::recursive);
+                });
+            }
+            catch(const std::exception& e)
+            {
+                m_messages.print("could not copy: ", entry.path(), "\n", e.what(), "\n");
+            }
+        }
+    }, BATCH_SIZE);
+}
+
+namespace
+{
+    // whether entry still is the file a journaled step was planned for. the contents of a directory
+    // change while it is deleted, moved into or copied, so only the identity of a directory is compared.
+    bool same_source(Entry& entry, const Journal::Section::Identity& identity)
+    {
+        const auto& metadata = entry.metadata();
+        return metadata.m_device == identity.m_device && metadata.m_inode == identity.m_inode &&
+            (metadata.m_type == fs::file_type::directory || (metadata.m_size == identity.m_size && metadata.m_modified == identity.m_modified));
+    }
+
+    // carries out one step of a journaled operation. a step may be carried out again after a crash, so
+    // copies overwrite what an interrupted copy left behind and a move whose source is gone is done. a
+    // step is resumed long after it was planned, so a source that was replaced by another file since is
+    // left alone.
+    void carry_out(InstrType kind, const fs::path& source, const fs::path& destination, const Journal::Section::Identity& identity,
+        std::uint64_t destination_device, SharedOutput& messages)
+    {
+        Entry entry(source);
+        if (entry.exists() && !same_source(entry, identity))
+        {
+            messages.print("skipped journaled operation on: ", source, "\nit changed since the operation was planned\n");
+            return;
+        }
+
+        switch (kind)
+        {
+        case InstrType::DELETE:
+            IoScheduler::shared().run(device_of(entry), 0, [&]() {
+                fs::remove_all(source);
+            });
+            break;
+        case InstrType::MOVE:
+            if (!entry.exists() && fs::exists(destination))
+            {
+                return;
+            }
+            IoScheduler::shared().run(device_of(entry), 0, [&]() {
+                fs::rename(source, destination);
+            });
+            break;
+        case InstrType::COPY:
+        {
+            auto n_bytes = entry.is_regular_file() ? entry.metadata().m_size : 0;
+            IoScheduler::shared().run(device_of(entry), destination_device, n_bytes, [&]() {
+                fs::copy(source, destination, fs::copy_options::recursive | fs::copy_options::overwrite_existing);
+            });
+            break;
+        }
+        default:
+            std::unreachable();
+        }
+    }
+}
+
+void Runtime::journaled_operation(InstrType kind, const fs::path& destination_path)
+{
+    constexpr std::size_t CHUNK_SIZE = 64;
+
+    auto& section = m_journal->next_section(kind, destination_path);
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    if (section.completed())
+    {
+        return;
+    }
+
+    // the plan of an interrupted run is resumed as it is, without walking the file system again
+    if (!section.planned())
+    {
+        PathArena paths;
+        std::unordered_set<fs::path> destinations;
+        std::mutex mutex;
+
+        cluster->execute_batched([&](std::span<Entry> entries) {
+            std::vector<char> selected(entries.size());
+            for (std::size_t i = 0; i < entries.size(); i++)
+            {
+                selected[i] = paths.intern(entries[i].path()).second && still_saved(entries[i], m_messages);
+            }
+
+            std::vector<fs::path> targets(entries.size());
+            if (kind != InstrType::DELETE)
             {
-                for (const auto& nested_path : fs::recursive_directory_iterator(path))
-                {
-                    if (fs::is_regular_file(nested_path) && (!m_rule || (*m_rule)(nested_path)))
-                    {
-                        m_parent->unpack(nested_path, operation);
-                    }
-                }
+                targets = reserve_destinations(entries, selected, destination_path, destinations, mutex);
             }
-            else
+            for (std::size_t i = 0; i < entries.size(); i++)
             {
-                if (!m_rule || (*m_rule)(path))
+                // an entry that cannot be stat'ed anymore is gone and leaves nothing to do
+                if (selected[i] && entries[i].exists())
                 {
-                    m_parent->unpack(path, operation);
+                    section.plan(entries[i].path(), targets[i], entries[i].metadata());
                 }
             }
-        }
-        else
-        {
-            if (fs::is_directory(path))
+        }, BATCH_SIZE);
+        section.finish_plan();
+    }
+
+    // a failed step is left for the next run to try again, and so is the operation
+    auto destination_device = kind == InstrType::COPY ? destination_device_of(destination_path) : 0;
+    std::atomic<bool> failed = false;
+    TaskGroup group;
+    for (std::size_t begin = 0; begin < section.size(); begin += CHUNK_SIZE)
+    {
+        group.submit([&, begin]() {
+            auto end = std::min(begin + CHUNK_SIZE, section.size());
+            for (auto step = begin; step < end; step++)
             {
-                for (const auto& nested_path : fs::recursive_directory_iterator(path))
+                if (section.done(step))
                 {
-                    if (fs::is_regular_file(nested_path) && (!m_rule || (*m_rule)(nested_path)))
-                    {
-                        operation(nested_path);
-                    }
+                    continue;
                 }
-            }
-            else
-            {
-                if (!m_rule || (*m_rule)(path))
+
+                auto source = section.source(step);
+                try
+                {
+                    carry_out(kind, source, section.destination(step), section.identity(step), destination_device, m_messages);
+                    section.mark_done(step);
+                }
+                catch(const fs::filesystem_error& e)
                 {
-                    operation(path);
+                    failed = true;
+                    m_messages.print("could not carry out journaled operation on: ", source, "\n", e.what(), "\n");
                 }
             }
-        }
+        });
     }
-    catch(const std::exception& e)
+    group.wait();
+
+    if (!failed)
     {
-        std::cout << "could not unpack recursively for: " << path << "\n" << e.what() << "\n";
+        section.complete();
     }
 }
 
-void DirectoriesCluster::unpack(const fs::path& path, std::function<void(const fs::path& path)> operation)
+namespace
 {
-    try
+    // what a sync has done so far, shared by every task that syncs its files
+    struct SyncProgress
     {
-        if (m_parent)
+        std::atomic<std::uint64_t> m_created = 0;
+        std::atomic<std::uint64_t> m_updated = 0;
+        std::atomic<std::uint64_t> m_unchanged = 0;
+        std::atomic<std::uint64_t> m_failed = 0;
+        std::atomic<std::uint64_t> m_bytes = 0;
+
+        // where files that fail are reported, and a dry run lists the files it would copy
+        SharedOutput* m_messages = nullptr;
+    };
+
+    // brings destination up to date with the regular file source
+    void sync_file(const fs::path& source, const fs::path& destination, std::uint64_t destination_device, const Sync& sync,
+        SyncProgress& progress)
+    {
+        try
         {
-            if (fs::is_directory(path))
+            Entry source_entry(source);
+            const auto& source_metadata = source_entry.metadata();
+
+            bool exists = false;
+            Entry destination_entry(destination);
+            if (destination_entry.exists())
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
+                exists = true;
+                const auto& destination_metadata = destination_entry.metadata();
+
+                // copies carry the modification time of their source, so an unchanged pair has equal times
+                bool unchanged = destination_metadata.m_size == source_metadata.m_size && (sync.m_checksum ?
+                    hash_file(source) == hash_file(destination) : destination_metadata.m_modified == source_metadata.m_modified);
+                if (unchanged)
                 {
-                    if (fs::is_directory(nested_path) && (!m_rule || (*m_rule)(nested_path)))
-                    {
-                        m_parent->unpack(nested_path, operation);
-                    }
+                    progress.m_unchanged.fetch_add(1, std::memory_order_relaxed);
+                    return;
                 }
             }
-        }
-        else
-        {
-            if (fs::is_directory(path))
+
+            if (sync.m_dry_run)
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
-                {
-                    if (fs::is_directory(nested_path) && (!m_rule || (*m_rule)(nested_path)))
-                    {
-                        operation(nested_path);
-                    }
-                }
+                progress.m_messages->write(std::format("{} -> {}\n", source.string(), destination.string()));
+            }
+            else
+            {
+                IoScheduler::shared().run(source_metadata.m_device, destination_device, source_metadata.m_size, [&]() {
+                    fs::copy_file(source, destination, fs::copy_options::overwrite_existing);
+                    fs::last_write_time(destination, fs::last_write_time(source));
+                });
             }
+            (exists ? progress.m_updated : progress.m_created).fetch_add(1, std::memory_order_relaxed);
+            progress.m_bytes.fetch_add(source_metadata.m_size, std::memory_order_relaxed);
+        }
+        catch(const std::exception& e)
+        {
+            progress.m_failed.fetch_add(1, std::memory_order_relaxed);
+            progress.m_messages->print("could not sync: ", source, "\n", e.what(), "\n");
         }
     }
-    catch(const std::exception& e)
-    {
-        std::cout << "could not unpack directories for: " << path << "\n" << e.what() << "\n";
-    }
-    
 }
 
-void FilesCluster::unpack(const fs::path& path, std::function<void(const fs::path& path)> operation)
+void Runtime::sync_operation(const Sync& sync)
 {
-    try
-    {
-        if (m_parent)
+    PathArena paths;
+    SyncProgress progress;
+    progress.m_messages = &m_messages;
+    auto destination_device = destination_device_of(sync.m_destination_path);
+
+    // the files are mirrored below the destination by name, so two returned paths with the same name
+    // would overwrite each other on every run. the first one keeps the name and the others fail.
+    std::unordered_set<fs::path> destinations;
+    std::mutex destinations_mutex;
+
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        for (auto& entry : entries)
         {
-            if (fs::is_directory(path))
+            if (!paths.intern(entry.path()).second || !still_saved(entry, m_messages))
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
-                {
-                    if (fs::is_regular_file(nested_path) && (!m_rule || (*m_rule)(nested_path)))
-                    {
-                        m_parent->unpack(nested_path, operation);
-                    }
-                }
+                continue;
             }
-            else
+
+            auto destination = sync.m_destination_path / entry.path().filename();
             {
-                if (!m_rule || (*m_rule)(path))
+                std::lock_guard<std::mutex> guard(destinations_mutex);
+                if (!destinations.insert(destination).second)
                 {
-                    m_parent->unpack(path, operation);
+                    progress.m_failed.fetch_add(1, std::memory_order_relaxed);
+                    m_messages.print("could not sync: ", entry.path(), "\n", destination, " is already synced from another path\n");
+                    continue;
                 }
             }
-        }
-        else
-        {
-            if (fs::is_directory(path))
+
+            if (entry.is_regular_file())
+            {
+                sync_file(entry.path(), destination, destination_device, sync, progress);
+            }
+            else if (entry.is_directory())
             {
-                for (const auto& nested_path : fs::directory_iterator(path))
+                // the files of a directory are mirrored below a directory of the same name, each one on its own
+                // task. directories are listed one at a time from an explicit stack, so no descriptors are held
+                // across levels, and one that cannot be listed is counted as failed without losing the rest.
+                auto group = TaskGroup::current();
+                std::vector<std::pair<fs::path, fs::path>> pending = { { entry.path(), destination } };
+                while (!pending.empty())
                 {
-                    if (fs::is_regular_file(nested_path) && (!m_rule || (*m_rule)(nested_path)))
+                    auto [source_directory, destination_directory] = std::move(pending.back());
+                    pending.pop_back();
+                    try
                     {
-                        operation(nested_path);
+                        if (!sync.m_dry_run)
+                        {
+                            fs::create_directories(destination_directory);
+                        }
+
+                        auto listing = read_directory(source_directory);
+                        Metrics::shared().add(Metrics::DIRECTORIES);
+                        Metrics::shared().add(Metrics::ENTRIES, listing->m_entries.size());
+                        for (const auto& nested : listing->m_entries)
+                        {
+                            auto nested_destination = destination_directory / nested.path().filename();
+                            if (nested.is_directory() && !nested.is_symlink())
+                            {
+                                pending.emplace_back(nested.path(), nested_destination);
+                            }
+                            else if (!nested.is_regular_file())
+                            {
+                                continue;
+                            }
+                            else if (group)
+                            {
+                                group->submit([&sync, &progress, destination_device, source = nested.path(), nested_destination]() {
+                                    sync_file(source, nested_destination, destination_device, sync, progress);
+                                });
+                            }
+                            else
+                            {
+                                sync_file(nested.path(), nested_destination, destination_device, sync, progress);
+                            }
+                        }
+                    }
+                    catch(const fs::filesystem_error& e)
+                    {
+                        progress.m_failed.fetch_add(1, std::memory_order_relaxed);
+                        m_messages.print("could not sync: ", source_directory, "\n", e.what(), "\n");
                     }
                 }
             }
-            else
+        }
+    }, BATCH_SIZE);
+
+    m_output << std::format("{}{} new, {} updated, {} unchanged, {} failed ({} bytes {})\n", sync.m_dry_run ? "dry run: " : "",
+        progress.m_created.load(), progress.m_updated.load(), progress.m_unchanged.load(), progress.m_failed.load(),
+        progress.m_bytes.load(), sync.m_dry_run ? "to copy" : "copied");
+    m_output.flush();
+}
+
+void Runtime::save_operation(const fs::path& manifest_path)
+{
+    PathArena paths;
+    PerWorker<std::vector<std::pair<PathArena::Id, Metadata>>> records;
+
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        records.update([&](std::vector<std::pair<PathArena::Id, Metadata>>& worker_records) {
+            for (auto& entry : entries)
             {
-                if (!m_rule || (*m_rule)(path))
+                auto [path, inserted] = paths.intern(entry.path());
+                if (inserted)
                 {
-                    operation(path);
+                    worker_records.emplace_back(path, entry.metadata());
                 }
             }
+        });
+    }, BATCH_SIZE);
+
+    std::vector<std::pair<fs::path, Metadata>> entries;
+    records.for_each([&](std::vector<std::pair<PathArena::Id, Metadata>>& worker_records) {
+        for (const auto& [path, metadata] : worker_records)
+        {
+            entries.emplace_back(paths.path(path), metadata);
         }
-    }
-    catch(const std::exception& e)
-    {
-        std::cout << "could not unpack files for: " << path << "\n" << e.what() << "\n";
-    }
+    });
+
+    // sorted so that saving the same entries twice gives the same manifest
+    std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    manifest::write(manifest_path, entries);
 }
 
-void* Runtime::stack_pop()
+void Runtime::aggregate_operation(const Aggregation& aggregation)
 {
-    if (m_operand_sp > 0)
+    // a bare count never needs to stat an entry
+    bool needs_size = std::any_of(aggregation.m_aggregates.begin(), aggregation.m_aggregates.end(), [](Aggregate aggregate) {
+        return aggregate != Aggregate::COUNT;
+    });
+
+    // every worker folds entries into its own groups, which are merged once the query is done. paths
+    // are only interned to drop duplicates when the same path can be reached through several inputs.
+    PerWorker<std::unordered_map<std::string, AggregateRow>> partials;
+    PathArena paths;
+
+    auto cluster = m_cluster_stack[--m_cluster_sp];
+    if (aggregation.m_approximation)
     {
-        return m_operand_stack[--m_operand_sp];
+        // only a plain walk of a tree can be probed, anything else is aggregated exactly
+        auto recursive = std::dynamic_pointer_cast<RecursiveCluster>(cluster);
+        if (recursive && !std::dynamic_pointer_cast<DuplicatesCluster>(cluster) && recursive->m_children.empty())
+        {
+            print_estimate(aggregation, recursive->estimate(*aggregation.m_approximation, needs_size));
+            return;
+        }
     }
-    throw std::runtime_error("runtime error: stack underflow");
-}
 
-void Runtime::stack_push(void* operand)
-{
-    if (m_operand_sp < m_operand_stack.size())
+    bool overlapping = cluster->has_overlapping_inputs();
+    cluster->execute_batched([&](std::span<Entry> entries) {
+        partials.update([&](std::unordered_map<std::string, AggregateRow>& groups) {
+            for (auto& entry : entries)
+            {
+                if (overlapping && !paths.intern(entry.path()).second)
+                {
+                    continue;
+                }
+
+                auto size = needs_size ? entry.metadata().m_size : 0;
+                groups[group_of(entry.path(), aggregation.m_group_key)].add(size);
+            }
+        });
+    }, BATCH_SIZE);
+
+    std::map<std::string, AggregateRow> groups;
+    partials.for_each([&](std::unordered_map<std::string, AggregateRow>& partial) {
+        for (const auto& [group, row] : partial)
+        {
+            groups[group].merge(row);
+        }
+    });
+
+    // an ungrouped aggregate always has a row, even when nothing was selected
+    if (aggregation.m_group_key == GroupKey::NONE)
     {
-        m_operand_stack[m_operand_sp++] = operand;
+        groups.try_emplace(std::string());
     }
-    else
+
+    switch (aggregation.m_group_key)
     {
-        throw std::runtime_error("runtime error: stack overflow");
+    case GroupKey::EXTENSION:
+        m_output << "extension\t";
+        break;
+    case GroupKey::DIRECTORY:
+        m_output << "directory\t";
+        break;
+    default: break;
     }
-}
-
-void Runtime::create_cluster(std::uint64_t n_paths)
-{
-    if (m_cluster_sp < m_cluster_stack.size())
+    for (std::size_t i = 0; i < aggregation.m_aggregates.size(); i++)
     {
-        std::shared_ptr<Cluster> cluster = nullptr;
+        m_output << (i ? "\t" : "") << aggregate_name(aggregation.m_aggregates[i]);
+    }
+    m_output << '\n';
 
-        auto select_specifier = reinterpret_cast<std::uint64_t>(stack_pop());
-        switch (select_specifier)
+    for (const auto& [group, row] : groups)
+    {
+        if (aggregation.m_group_key != GroupKey::NONE)
         {
-        case 0b11:
-            cluster = std::make_shared<Cluster>();
-            break;
-        case 0b10:
-            cluster = std::make_shared<DirectoriesCluster>();
-            break;
-        case 0b01:
-            cluster = std::make_shared<FilesCluster>();
-            break;
-        case 0b00:
-            cluster = std::make_shared<RecursiveCluster>();
-            break;
-        default: std::unreachable();
+            m_output << group << '\t';
         }
-
-        cluster->m_rule = reinterpret_cast<std::function<bool(const fs::path&)>*>(stack_pop());
-
-        for (; n_paths > 0; n_paths--)
+        for (std::size_t i = 0; i < aggregation.m_aggregates.size(); i++)
         {
-            auto element = *reinterpret_cast<fs::path*>(stack_pop());
-            cluster->m_paths.emplace_back(element);
+            m_output << (i ? "\t" : "") << row.value(aggregation.m_aggregates[i]);
         }
-        m_cluster_stack[m_cluster_sp++] = cluster;
-    }
-    else
-    {
-        throw std::runtime_error("runtime error: stack overflow");
+        m_output << '\n';
     }
+    m_output.flush();
 }
 
-void Runtime::merge_clusters(std::uint64_t n_clusters)
+void Runtime::print_estimate(const Aggregation& aggregation, const Estimate& estimate)
 {
-    if ((m_cluster_sp - static_cast<std::int64_t>(n_clusters)) >= 0)
+    for (std::size_t i = 0; i < aggregation.m_aggregates.size(); i++)
     {
-        auto parent = m_cluster_stack[--m_cluster_sp];
-        for (; n_clusters > 0; n_clusters--)
+        m_output << (i ? "\t" : "") << aggregate_name(aggregation.m_aggregates[i]);
+    }
+    m_output << '\n';
+
+    for (std::size_t i = 0; i < aggregation.m_aggregates.size(); i++)
+    {
+        bool count = aggregation.m_aggregates[i] == Aggregate::COUNT;
+        auto value = count ? estimate.m_count : estimate.m_size;
+        auto error = count ? estimate.m_count_error : estimate.m_size_error;
+        m_output << (i ? "\t" : "") << std::format("{:.0f}", value);
+        if (estimate.m_probes)
         {
-            auto child = m_cluster_stack[--m_cluster_sp];
-            child->m_parent = parent;
-            parent->m_children.emplace_back(child);
+            m_output << std::format(" ±{:.0f}", error);
         }
-        m_cluster_stack[m_cluster_sp++] = parent;
     }
-    else
+    m_output << '\n';
+
+    if (estimate.m_probes)
     {
-        throw std::runtime_error("runtime error: stack underflow");
+        m_output << std::format("estimated from {} probes at 95% confidence\n", estimate.m_probes);
+        if (!estimate.m_reliable)
+        {
+            m_output << std::format("only {} probes found matching entries, so the interval is not reliable\n", estimate.m_hits);
+        }
     }
+    m_output.flush();
 }
 
-void Runtime::display_operation()
+bool Runtime::conflicting(const Footprint& earlier, const Footprint& later) const
 {
-    std::unordered_set<fs::path> paths;
-    std::mutex paths_mutex;
-
-    auto cluster = m_cluster_stack[--m_cluster_sp];
-    cluster->execute([&](const fs::path& path) {
-        if (!paths.contains(path))
+    // a path contains another when it is the same path or one of its ancestors
+    auto overlapping = [](const std::vector<fs::path>& lhs, const std::vector<fs::path>& rhs) {
+        auto contains = [](const fs::path& outer, const fs::path& inner) {
+            auto [outer_end, inner_end] = std::mismatch(outer.begin(), outer.end(), inner.begin(), inner.end());
+            return outer_end == outer.end();
+        };
+        for (const auto& l : lhs)
         {
-            printf("%s\n", path.c_str());
-
-            std::lock_guard<std::mutex> guard(paths_mutex);
-            paths.insert(path);
+            for (const auto& r : rhs)
+            {
+                if (contains(l, r) || contains(r, l))
+                {
+                    return true;
+                }
+            }
         }
-    });
-}
+        return false;
+    };
 
-void Runtime::delete_operation()
-{
-    auto cluster = m_cluster_stack[--m_cluster_sp];
-    cluster->execute([&](const fs::path& path) {
-        fs::remove_all(path); // TODO: this seems to not be working for directories with files in it.
-    });
+    return overlapping(earlier.m_writes, later.m_reads) || overlapping(earlier.m_reads, later.m_writes) ||
+        overlapping(earlier.m_writes, later.m_writes) || (earlier.m_reads_stdin && later.m_reads_stdin) ||
+        (m_journal && earlier.m_journaled && later.m_journaled);
 }
 
-void Runtime::move_operation(fs::path& destination_path)
+void Runtime::run_concurrently(const std::vector<std::span<const Instr>>& queries, const std::vector<const Footprint*>& footprints)
 {
+    std::vector<std::vector<std::size_t>> dependencies(queries.size());
+    for (std::size_t later = 0; later < queries.size(); later++)
+    {
+        for (std::size_t earlier = 0; earlier < later; earlier++)
+        {
+            if (conflicting(*footprints[earlier], *footprints[later]))
+            {
+                dependencies[later].emplace_back(earlier);
+            }
+        }
+    }
+
+    // queries run on a fixed set of coordinator threads that hand the work to the shared pool, since a
+    // pool thread must not wait on a task group. a coordinator takes the earliest query whose
+    // dependencies have finished. once a query has failed, the queries after it in the script are not
+    // started anymore, but the ones before it still run, as they would have before it had the script
+    // been run in order.
+    OrderedOutput output(m_output, queries.size());
+    std::vector<char> started(queries.size()), finished(queries.size());
+    std::size_t first_failed = queries.size();
+    std::exception_ptr failure;
     std::mutex mutex;
+    std::condition_variable finished_condition;
 
-    auto cluster = m_cluster_stack[--m_cluster_sp];
-    cluster->execute([&](const fs::path& path) {
-        std::lock_guard<std::mutex> guard(mutex);
+    auto remaining = [&]() {
+        return std::find(started.begin(), started.begin() + first_failed, false) != started.begin() + first_failed;
+    };
 
-        fs::rename(path, destination_path / unique_filename(path.filename(), destination_path));
-    });
-}
+    auto next_ready = [&]() {
+        for (std::size_t query = 0; query < first_failed; query++)
+        {
+            auto ready = std::all_of(dependencies[query].begin(), dependencies[query].end(), [&](std::size_t dependency) {
+                return finished[dependency];
+            });
+            if (!started[query] && ready)
+            {
+                return query;
+            }
+        }
+        return queries.size();
+    };
 
-void Runtime::copy_operation(fs::path& destination_path)
-{
-    std::unordered_set<fs::path> paths;
-    std::mutex mutex;
+    auto coordinate = [&]() {
+        while (true)
+        {
+            std::size_t query = queries.size();
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished_condition.wait(lock, [&]() {
+                    query = next_ready();
+                    return query != queries.size() || !remaining();
+                });
+                if (query == queries.size())
+                {
+                    return;
+                }
+                started[query] = true;
+            }
 
-    auto cluster = m_cluster_stack[--m_cluster_sp];
-    cluster->execute([&](const fs::path& path) {
-        if (!paths.contains(path))
+            try
+            {
+                Runtime runtime(*this, output.stream(query));
+                runtime.execute(queries[query]);
+            }
+            catch(...)
+            {
+                // the earliest failure in script order is the one reported, as it would have been run first
+                std::lock_guard<std::mutex> guard(mutex);
+                if (query < first_failed)
+                {
+                    first_failed = query;
+                    failure = std::current_exception();
+                }
+            }
+            output.finish(query);
+
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                finished[query] = true;
+            }
+            finished_condition.notify_all();
+        }
+    };
+
+    // the coordinators that could be started take every query between them, so running short of threads
+    // only fails the script when not even one could be started
+    auto n_coordinators = std::min(ThreadPool::shared().size(), queries.size());
+    std::vector<std::thread> coordinators;
+    try
+    {
+        for (std::size_t i = 0; i < n_coordinators; i++)
+        {
+            coordinators.emplace_back(coordinate);
+        }
+    }
+    catch(const std::system_error& e)
+    {
+        if (coordinators.empty())
         {
-            std::lock_guard<std::mutex> guard(mutex);
+            throw;
+        }
+    }
+
+    for (auto& coordinator : coordinators)
+    {
+        coordinator.join();
+    }
 
-            fs::copy(path, destination_path / unique_filename(path.filename(), destination_path), fs::copy_options::recursive);
-            paths.insert(path);
+    // the output of queries that had already started after the failed one is held back behind the ones
+    // skipped
+    for (std::size_t query = 0; query < queries.size(); query++)
+    {
+        if (!started[query])
+        {
+            output.finish(query);
         }
-    });
+    }
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+}
+
+Runtime::Runtime(MetadataCache* cache, std::ostream& output, std::istream* paths_input, Journal* journal)
+    : m_operand_sp(0), m_cluster_sp(0), m_cache(cache), m_output(output), m_messages(output),
+    m_interactive(&output == &std::cout && isatty(STDOUT_FILENO)), m_paths_input(paths_input), m_journal(journal),
+    m_generation(std::make_shared<std::atomic<std::uint64_t>>(0))
+{
 }
 
 void Runtime::run(std::vector<Instr>&& program)
 {
+    std::vector<std::span<const Instr>> queries;
+    std::vector<const Footprint*> footprints;
+    for (std::size_t i = 0; i < program.size(); i++)
+    {
+        if (program[i].m_type == InstrType::QUERY)
+        {
+            queries.emplace_back(program.data() + i, program.size() - i);
+            footprints.emplace_back(reinterpret_cast<const Footprint*>(program[i].m_operand));
+            if (queries.size() > 1)
+            {
+                auto& previous = queries[queries.size() - 2];
+                previous = previous.first(program.data() + i - previous.data());
+            }
+        }
+    }
+
+    if (queries.size() > 1)
+    {
+        run_concurrently(queries, footprints);
+    }
+    else
+    {
+        execute(program);
+    }
+}
+
+void Runtime::execute(std::span<const Instr> program)
+{
+    // a runtime may be reused across statements, so discard anything a failed run left behind
+    m_operand_sp = 0;
+    m_cluster_sp = 0;
+
     for (const auto& instr : program)
     {
         switch (instr.m_type)
         {
+        case InstrType::QUERY:
+            break;
         case InstrType::PUSH:
             stack_push(instr.m_operand);
             break;
@@ -379,6 +2159,15 @@ void Runtime::run(std::vector<Instr>&& program)
         case InstrType::MERGE_CLUSTERS:
             merge_clusters(reinterpret_cast<std::uint64_t>(instr.m_operand));
             break;
+        case InstrType::ORDER:
+            order_cluster(*reinterpret_cast<Ordering*>(instr.m_operand));
+            break;
+        case InstrType::LIMIT:
+            limit_cluster(reinterpret_cast<std::uint64_t>(instr.m_operand));
+            break;
+        case InstrType::MEMOIZE:
+            memoize_cluster(*reinterpret_cast<Memo*>(instr.m_operand));
+            break;
         case InstrType::DISPLAY:
             display_operation();
             break;
@@ -391,6 +2180,21 @@ void Runtime::run(std::vector<Instr>&& program)
         case InstrType::MOVE:
             move_operation(*reinterpret_cast<fs::path*>(instr.m_operand));
             break;
+        case InstrType::SYNC:
+            sync_operation(*reinterpret_cast<Sync*>(instr.m_operand));
+            break;
+        case InstrType::SAVE:
+            save_operation(*reinterpret_cast<fs::path*>(instr.m_operand));
+            break;
+        case InstrType::AGGREGATE:
+            aggregate_operation(*reinterpret_cast<Aggregation*>(instr.m_operand));
+            break;
+        }
+
+        // sub-queries recorded before an operation that writes may return something else afterwards
+        if (writes_file_system(instr.m_type))
+        {
+            m_generation->fetch_add(1);
         }
     }
 }
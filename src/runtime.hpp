@@ -2,70 +2,400 @@
 #define RUNTIME_HPP
 
 #include <array>
+#include <atomic>
 #include <filesystem>
 #include <functional>
+#include <iostream>
+#include <span>
+#include <stop_token>
 #include <unordered_set>
 
+#include "cache.hpp"
+#include "journal.hpp"
+#include "path_arena.hpp"
 #include "runtime_types.hpp"
+#include "shared_output.hpp"
+#include "thread_pool.hpp"
+#include "visited_set.hpp"
+
+using Operation = std::function<void(Entry& entry)>;
+
+// receives the entries a cluster returns a batch at a time. the entries are only valid during the call.
+using BatchOperation = std::function<void(std::span<Entry> entries)>;
 
 class Cluster
 {
     public:
-        Cluster() : m_parent(nullptr) {};
+        Cluster() : m_parent(nullptr), m_traversal(nullptr), m_cache(nullptr), m_messages(nullptr) {};
+
+        virtual void execute(const Operation& operation);
+
+        // executes the cluster with every worker collecting the entries it returns into batches of up to
+        // batch_size entries, so that operations lock, deduplicate and write once per batch
+        void execute_batched(const BatchOperation& operation, std::size_t batch_size);
+
+        // clusters that only produce entries themselves pass on what they are handed if it matches the rule
+        virtual void unpack(Entry& entry, const Operation& operation);
+
+        // must be called whenever m_parent or m_rule change, before the cluster is executed
+        virtual void specialize() {};
 
-        void execute(std::function<void(const std::filesystem::path& path)> operation);
+        // whether the same path can reach the operation more than once
+        virtual bool has_overlapping_inputs() const;
 
-        virtual void unpack(const std::filesystem::path& path, std::function<void(const std::filesystem::path& path)> operation);
+        // lets the cluster and its children give up on their remaining work once a stop is requested
+        void set_stop_token(std::stop_token stop_token);
 
     public:
         std::shared_ptr<Cluster> m_parent;
         std::vector<std::shared_ptr<Cluster>> m_children;
         std::vector<std::filesystem::path> m_paths;
-        std::function<bool(const std::filesystem::path&)>* m_rule;
+        Predicate* m_rule;
+        Traversal* m_traversal;
+        MetadataCache* m_cache;
+
+        // where entries that cannot be read are reported, the output of the runtime that created the cluster
+        SharedOutput* m_messages;
+
+        // the directories walked so far, when the traversal follows symbolic links
+        std::unique_ptr<VisitedSet> m_visited;
+
+    protected:
+        bool stopped() const { return m_stop_token.stop_requested(); };
+
+        // whether the directory has not been walked by the cluster yet, or only below the given depth, following
+        // symbolic links. throws std::filesystem::filesystem_error when the directory cannot be stat'ed.
+        VisitedSet::Claim claim_directory(const std::filesystem::path& directory, std::uint64_t depth = 0);
+
+        // hands a selected path to the parent cluster, or to the operation when there is no parent
+        void emit(Entry& entry, const Operation& operation);
+
+        std::shared_ptr<const DirectoryListing> list_directory(const std::filesystem::path& directory);
+
+        template<typename Visit>
+        void visit_entries(const std::shared_ptr<const DirectoryListing>& listing, Visit visit);
+
+    protected:
+        std::stop_token m_stop_token;
+};
+
+// the count and total size of the entries a query returns as estimated from random probes of its tree,
+// with the half widths of their 95% confidence intervals
+struct Estimate
+{
+    double m_count = 0;
+    double m_count_error = 0;
+    double m_size = 0;
+    double m_size_error = 0;
+    std::uint64_t m_probes = 0;
+
+    // probes that found a returned entry. the interval is not reliable when only a few did.
+    std::uint64_t m_hits = 0;
+    bool m_reliable = true;
+};
+
+enum class Selection
+{
+    ALL,
+    FILES,
+    DIRECTORIES,
+    RECURSIVE,
+};
+
+enum class RuleMode
+{
+    NONE,
+
+    // the rule is evaluated entry by entry
+    ENTRY,
+
+    // the rule only looks at names, and is evaluated over all the names of a listing at once
+    BLOCK,
+};
+
+// the clusters that select entries from the directories they are handed. their traversal is compiled
+// once per combination of what they select, whether they have a parent and how their rule is evaluated,
+// and specialize() picks the one that applies, so that the loop over the entries of a directory does
+// not check any of it again.
+template<Selection Kind>
+class SelectCluster : public Cluster
+{
+    public:
+        SelectCluster() : m_kernel(&SelectCluster::kernel<false, RuleMode::NONE>) {};
+
+        void unpack(Entry& entry, const Operation& operation) { (this->*m_kernel)(entry, operation); };
+
+        void specialize();
+
+        // estimates the entries the cluster returns without walking all of its tree. every probe descends
+        // from a root along randomly picked subdirectories, and weighs what it finds in a directory by the
+        // product of the fan-outs it passed on the way, which makes the average of the probes an unbiased
+        // estimate of what a full walk would find (Knuth's estimator of the size of a search tree).
+        Estimate estimate(const Approximation& approximation, bool needs_size) requires (Kind == Selection::RECURSIVE);
+
+    protected:
+        using Kernel = void (SelectCluster::*)(Entry& entry, const Operation& operation);
+
+        template<bool HasParent, RuleMode Rule>
+        void kernel(Entry& entry, const Operation& operation);
+
+        // the entries of directory are depth levels below the path the walk started from
+        template<bool HasParent, RuleMode Rule>
+        void walk(const std::filesystem::path& directory, std::uint64_t depth, const Operation& operation);
+
+        template<bool HasParent>
+        void emit_to(Entry& entry, const Operation& operation)
+        {
+            if constexpr (HasParent)
+            {
+                m_parent->unpack(entry, operation);
+            }
+            else
+            {
+                operation(entry);
+            }
+        };
+
+        RuleMode rule_mode() const;
+
+        template<RuleMode Rule>
+        bool matches(Entry& entry) const
+        {
+            if constexpr (Rule != RuleMode::NONE)
+            {
+                return (*m_rule)(entry);
+            }
+            return true;
+        };
+
+        // the names of a listing that a block rule selects, empty for other rules
+        template<RuleMode Rule>
+        NameSelection select_names(const DirectoryListing& listing) const
+        {
+            NameSelection selection;
+            if constexpr (Rule == RuleMode::BLOCK)
+            {
+                m_rule->m_block_function(listing.m_names, selection);
+            }
+            return selection;
+        };
+
+        // whether the entry at index of a listing matches the rule, given what select_names() returned
+        template<RuleMode Rule>
+        bool listed_matches(Entry& entry, const NameSelection& selection, std::size_t index) const
+        {
+            if constexpr (Rule == RuleMode::BLOCK)
+            {
+                return selected(selection, index);
+            }
+            return matches<Rule>(entry);
+        };
+
+    protected:
+        Kernel m_kernel;
+};
+
+using AllCluster = SelectCluster<Selection::ALL>;
+using FilesCluster = SelectCluster<Selection::FILES>;
+using DirectoriesCluster = SelectCluster<Selection::DIRECTORIES>;
+using RecursiveCluster = SelectCluster<Selection::RECURSIVE>;
+
+// returns the files below its paths that are identical to another one, leaving out the first path of
+// every group of identical files so that operations act on the redundant copies only
+class DuplicatesCluster : public RecursiveCluster
+{
+    public:
+        void execute(const Operation& operation);
+
+        // the walk never hands files to the parent, they are only candidates until they are compared
+        void specialize();
+
+    private:
+        void collect(Entry& entry);
+
+    private:
+        struct Candidate
+        {
+            std::uint64_t m_size;
+            std::uint64_t m_digest;
+            std::uint64_t m_device;
+            std::uint64_t m_inode;
+            PathArena::Id m_path;
+        };
+
+        static constexpr std::size_t EDGE_SIZE = 4096;
+
+        // keeps one path of every file that is reached through several hard links, the first one in
+        // lexicographic order
+        void drop_hard_links(std::vector<Candidate>& candidates) const;
+
+        static bool same_contents(const Candidate& lhs, const Candidate& rhs);
+        static void retain_collisions(std::vector<Candidate>& candidates);
+
+        template<typename Digest>
+        static void digest_candidates(std::vector<Candidate>& candidates, Digest digest);
+
+    private:
+        PerWorker<std::vector<Candidate>> m_candidates;
+
+        // every candidate is interned once, which also drops paths reached through overlapping inputs
+        PathArena m_arena;
 };
 
-class RecursiveCluster : public Cluster
+// streams the entries of the manifests in m_paths to its parent, with the metadata they were saved with
+class ManifestCluster : public Cluster
 {
     public:
-        void unpack(const std::filesystem::path& path, std::function<void(const std::filesystem::path& path)> operation);
+        void execute(const Operation& operation);
 };
 
-class DirectoriesCluster : public Cluster
+// reads newline or NUL delimited paths and hands them to its parent while reading is still going on
+class StreamCluster : public Cluster
 {
     public:
-        void unpack(const std::filesystem::path& path, std::function<void(const std::filesystem::path& path)> operation);
+        StreamCluster(std::istream& input) : m_input(input) {};
+
+        void execute(const Operation& operation);
+
+        // nothing keeps an external path list from naming the same path twice
+        bool has_overlapping_inputs() const { return true; };
+
+    private:
+        std::istream& m_input;
 };
 
-class FilesCluster : public Cluster
+// returns the entries of its source cluster sorted by the ordering key, keeping only the first m_limit.
+// every worker keeps its own bounded heap of the best entries it has seen, so memory does not grow
+// with the number of entries scanned, and the heaps are merged once the source has been executed.
+class OrderedCluster : public Cluster
 {
     public:
-        void unpack(const std::filesystem::path& path, std::function<void(const std::filesystem::path& path)> operation); 
+        OrderedCluster(std::shared_ptr<Cluster> source, const Ordering& ordering)
+            : m_source(source), m_ordering(ordering) { m_rule = nullptr; };
+
+        void execute(const Operation& operation);
+
+    private:
+        struct Candidate
+        {
+            std::int64_t m_rank;
+            std::string m_name;
+            std::filesystem::path m_path;
+        };
+
+        // whether lhs comes before rhs in the requested order
+        bool before(const Candidate& lhs, const Candidate& rhs) const;
+
+    private:
+        std::shared_ptr<Cluster> m_source;
+        const Ordering& m_ordering;
+        PerWorker<std::vector<Candidate>> m_heaps;
+};
+
+// returns the first m_limit entries its source cluster produces, in no particular order. the whole
+// cluster tree is stopped as soon as enough entries have been produced.
+class LimitedCluster : public Cluster
+{
+    public:
+        LimitedCluster(std::shared_ptr<Cluster> source, std::uint64_t limit)
+            : m_source(source), m_limit(limit) { m_rule = nullptr; };
+
+        void execute(const Operation& operation);
+
+    private:
+        std::shared_ptr<Cluster> m_source;
+        std::uint64_t m_limit;
+        std::stop_source m_stop_source;
+};
+
+// replays the recorded results of a sub-query that occurs more than once in the script, or runs the
+// sub-query and records what it returns when there is nothing recorded for the current generation.
+// results that a stop cut short are never recorded.
+class MemoizedCluster : public Cluster
+{
+    public:
+        MemoizedCluster(std::shared_ptr<Cluster> source, Memo& memo, std::uint64_t generation)
+            : m_memo(memo), m_generation(generation) { m_rule = nullptr; m_children.emplace_back(source); };
+
+        void execute(const Operation& operation);
+
+    private:
+        Memo& m_memo;
+        std::uint64_t m_generation;
 };
 
 class Runtime
 {
     public:
-        Runtime() : m_operand_sp(0), m_cluster_sp(0) {};
+        Runtime(MetadataCache* cache = nullptr, std::ostream& output = std::cout, std::istream* paths_input = nullptr,
+            Journal* journal = nullptr);
 
+        // runs the queries of the program at the same time unless they conflict, see conflicting()
         void run(std::vector<Instr>&& program);
 
     private:
+        // runs one query of the script of parent, writing its output to output
+        Runtime(const Runtime& parent, std::ostream& output)
+            : m_operand_sp(0), m_cluster_sp(0), m_cache(parent.m_cache), m_output(output), m_messages(output), m_interactive(parent.m_interactive),
+            m_paths_input(parent.m_paths_input), m_journal(parent.m_journal), m_generation(parent.m_generation) {};
+
+        void execute(std::span<const Instr> program);
+        void run_concurrently(const std::vector<std::span<const Instr>>& queries, const std::vector<const Footprint*>& footprints);
+
+        // whether a query has to wait for an earlier one: when one changes something below a path the
+        // other reads or changes, when both read stdin, or when both go through the journal
+        bool conflicting(const Footprint& earlier, const Footprint& later) const;
+
         void* stack_pop();
         void stack_push(void* operand);
 
         void create_cluster(std::uint64_t n_paths);
         void merge_clusters(std::uint64_t n_clusters);
+        void order_cluster(const Ordering& ordering);
+        void limit_cluster(std::uint64_t limit);
+        void memoize_cluster(Memo& memo);
 
         void display_operation();
         void delete_operation();
         void copy_operation(std::filesystem::path& destination_path);
         void move_operation(std::filesystem::path& destination_path);
+        void aggregate_operation(const Aggregation& aggregation);
+        void print_estimate(const Aggregation& aggregation, const Estimate& estimate);
+        void save_operation(const std::filesystem::path& manifest_path);
+        void sync_operation(const Sync& sync);
+
+        // delete, copy and move go through the journal when there is one
+        void journaled_operation(InstrType kind, const std::filesystem::path& destination_path);
 
     private:
         std::array<std::shared_ptr<Cluster>, 1024> m_cluster_stack;
         std::array<void*, 1024> m_operand_stack;
         int m_operand_sp;
         int m_cluster_sp;
+
+        // optional listing cache shared with every cluster this runtime creates
+        MetadataCache* m_cache;
+
+        // destination of display output, which is a client connection when serving
+        std::ostream& m_output;
+
+        // m_output for the workers of a query, which write per-entry messages and display output through it
+        SharedOutput m_messages;
+
+        // whether display output ends up on a terminal, which shows every entry as soon as it is found instead
+        // of a batch at a time. decided by the top-level runtime, as the queries of a script write into
+        // buffers of their own.
+        bool m_interactive;
+
+        // source of the paths of the stdin element, if there is one
+        std::istream* m_paths_input;
+
+        // write-ahead journal that makes bulk operations resumable, if there is one
+        Journal* m_journal;
+
+        // counts the disk operations run so far, which may have changed what recorded sub-queries return.
+        // shared with the runtimes of the queries of a script that run at the same time.
+        std::shared_ptr<std::atomic<std::uint64_t>> m_generation;
 };
 
 #endif
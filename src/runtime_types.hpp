@@ -1,16 +1,42 @@
 #ifndef RUNTIME_TYPES_HPP
 #define RUNTIME_TYPES_HPP
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "entry.hpp"
+#include "name_block.hpp"
+#include "path_arena.hpp"
+#include "pattern.hpp"
+
 enum class InstrType
 {
     PUSH,
     CREATE_CLUSTER,
     MERGE_CLUSTERS,
+    ORDER,
+    LIMIT,
 
     DELETE,
     COPY,
     MOVE,
-    DISPLAY
+    DISPLAY,
+    SAVE,
+    SYNC,
+    AGGREGATE,
+
+    MEMOIZE,
+
+    // starts the instructions of a query, whose Footprint is the operand
+    QUERY
 };
 
 struct Instr
@@ -19,4 +45,145 @@ struct Instr
     void* m_operand;
 };
 
+// rough relative cost of evaluating a predicate once, used to order and schedule evaluation
+enum PredicateCost : std::uint32_t
+{
+    NAME_COST = 1,
+    METADATA_COST = 4,
+    CONTENT_COST = 256
+};
+
+// compiled form of a rule as seen by the runtime
+struct Predicate
+{
+    bool operator()(Entry& entry) const { return m_function(entry); };
+
+    std::function<bool(Entry&)> m_function;
+    std::uint32_t m_cost = NAME_COST;
+
+    // evaluates the rule over all the names of a listing at once. only rules that look at nothing but
+    // names have one.
+    std::function<void(const NameBlock& names, NameSelection& selection)> m_block_function;
+};
+
+// copies entries into m_destination_path unless an identical copy is already there
+struct Sync
+{
+    std::filesystem::path m_destination_path;
+
+    // compare contents instead of modification times when sizes are equal
+    bool m_checksum = false;
+
+    // only count what would be copied
+    bool m_dry_run = false;
+};
+
+enum class Aggregate
+{
+    COUNT,
+    SUM_SIZE,
+    MIN_SIZE,
+    MAX_SIZE
+};
+
+enum class GroupKey
+{
+    NONE,
+    EXTENSION,
+    DIRECTORY
+};
+
+// an aggregate estimated from random probes of the tree instead of a walk over all of it. probing
+// stops once the 95% confidence interval is within m_error of the estimate, or m_budget has passed.
+struct Approximation
+{
+    double m_error = 0.05;
+    std::chrono::milliseconds m_budget = std::chrono::seconds(10);
+};
+
+// every aggregate is computed for each group of entries sharing the group key
+struct Aggregation
+{
+    std::vector<Aggregate> m_aggregates;
+    GroupKey m_group_key = GroupKey::NONE;
+    std::optional<Approximation> m_approximation;
+};
+
+enum class OrderKey
+{
+    SIZE,
+    MODIFIED,
+    NAME
+};
+
+struct Ordering
+{
+    OrderKey m_key;
+    bool m_descending = false;
+    std::uint64_t m_limit = std::numeric_limits<std::uint64_t>::max();
+};
+
+// the results of a sub-query that occurs more than once in a script. the first occurrence to run
+// records them, and the others replay them instead of walking again until a disk operation runs.
+struct Memo
+{
+    struct Result
+    {
+        PathArena::Id m_path;
+        std::filesystem::file_type m_type;
+    };
+
+    struct Recording
+    {
+        // the disk operations the runtime had run when the results were recorded
+        std::uint64_t m_generation = 0;
+
+        PathArena m_paths;
+        std::vector<Result> m_results;
+    };
+
+    // replaced as a whole, so that queries still replaying an older recording keep it alive
+    std::shared_ptr<const Recording> m_latest;
+
+    // an occurrence that runs while another one records waits for the recording instead of walking too
+    std::mutex m_mutex;
+    std::condition_variable m_recorded;
+    bool m_recording = false;
+};
+
+// the paths a query reads and the paths below which it may change something, which decide whether it
+// can run at the same time as the other queries of its script
+struct Footprint
+{
+    std::vector<std::filesystem::path> m_reads;
+    std::vector<std::filesystem::path> m_writes;
+
+    bool m_reads_stdin = false;
+
+    // whether the operation goes through the journal, which expects operations in script order
+    bool m_journaled = false;
+};
+
+// limits on how far a cluster walks, applied before a directory is opened
+struct Traversal
+{
+    bool excludes(std::string_view name) const
+    {
+        for (const auto& pattern : m_excluded)
+        {
+            if (pattern.matches(name))
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<NamePattern> m_excluded;
+    std::uint64_t m_max_depth = std::numeric_limits<std::uint64_t>::max();
+
+    // descend into symbolic links to directories, walking every directory once however many links lead to it
+    bool m_follow_symlinks = false;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "search.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "fd_budget.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // files are read in chunks of this size, smaller ones in a single read
+    constexpr std::size_t CHUNK_SIZE = 4 << 20;
+
+    bool scalar_contains(std::string_view haystack, std::string_view needle)
+    {
+        return haystack.find(needle) != std::string_view::npos;
+    }
+
+#if defined(__x86_64__)
+    // the first and last byte of the needle are compared against a whole block of candidate positions,
+    // and only positions where both match have the bytes in between compared
+    bool sse2_contains(std::string_view haystack, std::string_view needle)
+    {
+        const auto n = needle.size();
+        const __m128i first = _mm_set1_epi8(needle.front());
+        const __m128i last = _mm_set1_epi8(needle.back());
+
+        std::size_t i = 0;
+        for (; i + n - 1 + 16 <= haystack.size(); i += 16)
+        {
+            auto block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i));
+            auto block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack.data() + i + n - 1));
+
+            unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+            for (; mask; mask &= mask - 1)
+            {
+                if (std::memcmp(haystack.data() + i + __builtin_ctz(mask) + 1, needle.data() + 1, n - 2) == 0)
+                {
+                    return true;
+                }
+            }
+        }
+        return scalar_contains(haystack.substr(i), needle);
+    }
+
+    __attribute__((target("avx2")))
+    bool avx2_contains(std::string_view haystack, std::string_view needle)
+    {
+        const auto n = needle.size();
+        const __m256i first = _mm256_set1_epi8(needle.front());
+        const __m256i last = _mm256_set1_epi8(needle.back());
+
+        std::size_t i = 0;
+        for (; i + n - 1 + 32 <= haystack.size(); i += 32)
+        {
+            auto block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack.data() + i));
+            auto block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack.data() + i + n - 1));
+
+            unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+            for (; mask; mask &= mask - 1)
+            {
+                if (std::memcmp(haystack.data() + i + __builtin_ctz(mask) + 1, needle.data() + 1, n - 2) == 0)
+                {
+                    return true;
+                }
+            }
+        }
+        return sse2_contains(haystack.substr(i), needle);
+    }
+#endif
+}
+
+bool contains_substring(std::string_view haystack, std::string_view needle)
+{
+    if (needle.empty())
+    {
+        return true;
+    }
+    if (needle.size() > haystack.size())
+    {
+        return false;
+    }
+    if (needle.size() == 1)
+    {
+        return std::memchr(haystack.data(), needle.front(), haystack.size()) != nullptr;
+    }
+
+#if defined(__x86_64__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2 ? avx2_contains(haystack, needle) : sse2_contains(haystack, needle);
+#else
+    return scalar_contains(haystack, needle);
+#endif
+}
+
+bool file_contains(const fs::path& path, std::string_view needle)
+{
+    if (needle.empty())
+    {
+        return true;
+    }
+
+    // non-blocking so opening a fifo does not wait for a writer; it is rejected as not regular below
+    auto lease = FdBudget::shared().lease();
+    int fd = open_descriptor(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool found = false;
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+    {
+        // the file is read rather than mapped, so one truncated while it is scanned only ends the scan early.
+        // consecutive chunks overlap by one byte less than the needle so matches across a boundary are found
+        std::vector<char> buffer(std::min<std::size_t>(status.st_size, CHUNK_SIZE) + needle.size());
+        std::size_t chunk_size = buffer.size() - needle.size();
+        std::size_t carried = 0;
+        off_t offset = 0;
+        for (ssize_t n_read; !found && (n_read = pread(fd, buffer.data() + carried, chunk_size, offset)) != 0;)
+        {
+            if (n_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            offset += n_read;
+
+            std::size_t available = carried + n_read;
+            found = contains_substring(std::string_view(buffer.data(), available), needle);
+
+            carried = std::min(available, needle.size() - 1);
+            std::memmove(buffer.data(), buffer.data() + available - carried, carried);
+        }
+    }
+
+    close(fd);
+    return found;
+}
@@ -0,0 +1,14 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <filesystem>
+#include <string_view>
+
+// vectorized substring search (AVX2 or SSE2 when available, scalar otherwise)
+bool contains_substring(std::string_view haystack, std::string_view needle);
+
+// whether the contents of a regular file contain needle. the file is streamed in chunks, and files that
+// cannot be read (or are not regular files) never match.
+bool file_contains(const std::filesystem::path& path, std::string_view needle);
+
+#endif
@@ -0,0 +1,328 @@
+#include "server.hpp"
+
+#include <array>
+#include <csignal>
+#include <cstring>
+#include <format>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "parser.hpp"
+#include "runtime.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    enum class FrameKind : char
+    {
+        OUTPUT = 'o',
+        ERROR = 'e',
+        EXIT = 'x'
+    };
+
+    bool write_all(int fd, const char* data, std::size_t size)
+    {
+        while (size)
+        {
+            auto written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    bool read_all(int fd, char* data, std::size_t size)
+    {
+        while (size)
+        {
+            auto n_read = ::read(fd, data, size);
+            if (n_read <= 0)
+            {
+                if (n_read < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += n_read;
+            size -= n_read;
+        }
+        return true;
+    }
+
+    bool send_frame(int fd, FrameKind kind, const char* payload, std::uint32_t size)
+    {
+        std::array<char, 5> header = { static_cast<char>(kind), static_cast<char>(size), static_cast<char>(size >> 8),
+            static_cast<char>(size >> 16), static_cast<char>(size >> 24) };
+        return write_all(fd, header.data(), header.size()) && write_all(fd, payload, size);
+    }
+
+    // stream buffer that sends everything written to it as output frames
+    class FrameBuffer : public std::streambuf
+    {
+        public:
+            FrameBuffer(int connection) : m_connection(connection)
+            {
+                setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+            };
+
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                if (sync() == -1)
+                {
+                    return traits_type::eof();
+                }
+                if (!traits_type::eq_int_type(ch, traits_type::eof()))
+                {
+                    *pptr() = traits_type::to_char_type(ch);
+                    pbump(1);
+                }
+                return traits_type::not_eof(ch);
+            }
+
+            int sync() override
+            {
+                auto size = pptr() - pbase();
+                if (size && !send_frame(m_connection, FrameKind::OUTPUT, pbase(), size))
+                {
+                    return -1;
+                }
+                setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+                return 0;
+            }
+
+        private:
+            int m_connection;
+            std::array<char, 1 << 16> m_buffer;
+    };
+
+    // scripts are small, a request past this is refused instead of being buffered without bound
+    constexpr std::size_t MAX_REQUEST_SIZE = 16 << 20;
+
+    // the socket path is kept in static storage so the signal handler can unlink it
+    std::array<char, sizeof(sockaddr_un::sun_path)> g_socket_path{};
+
+    void remove_socket_and_exit(int signal)
+    {
+        ::unlink(g_socket_path.data());
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+
+    sockaddr_un socket_address(const fs::path& socket_path)
+    {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (socket_path.native().size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error(std::format("server error: socket path is too long: {}", socket_path.string()));
+        }
+        std::strcpy(address.sun_path, socket_path.c_str());
+        return address;
+    }
+}
+
+Server::Server(const fs::path& socket_path) : m_socket_path(socket_path)
+{
+    auto address = socket_address(socket_path);
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_socket < 0)
+    {
+        throw std::runtime_error(std::format("server error: could not create socket: {}", std::strerror(errno)));
+    }
+
+    // a socket left behind by a server that did not shut down cleanly would make bind fail, but one
+    // that still accepts connections belongs to a live server and is left alone
+    if (fs::is_socket(socket_path))
+    {
+        if (connect(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 || errno != ECONNREFUSED)
+        {
+            close(m_socket);
+            throw std::runtime_error(std::format("server error: {} is in use by a running server", socket_path.string()));
+        }
+        fs::remove(socket_path);
+    }
+
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(m_socket, SOMAXCONN) < 0)
+    {
+        auto error = errno;
+        close(m_socket);
+        throw std::runtime_error(std::format("server error: could not listen on {}: {}", socket_path.string(), std::strerror(error)));
+    }
+
+    std::strcpy(g_socket_path.data(), address.sun_path);
+    std::signal(SIGINT, remove_socket_and_exit);
+    std::signal(SIGTERM, remove_socket_and_exit);
+}
+
+Server::~Server()
+{
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    close(m_socket);
+    fs::remove(m_socket_path);
+}
+
+void Server::serve()
+{
+    std::signal(SIGPIPE, SIG_IGN);
+
+    while (true)
+    {
+        int connection = accept(m_socket, nullptr, nullptr);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            throw std::runtime_error(std::format("server error: accept failed: {}", std::strerror(errno)));
+        }
+
+        std::thread([this, connection]() {
+            handle(connection);
+        }).detach();
+    }
+}
+
+void Server::handle(int connection)
+{
+    std::string request;
+    std::array<char, 4096> buffer;
+    for (ssize_t n_read; (n_read = ::read(connection, buffer.data(), buffer.size())) != 0;)
+    {
+        if (n_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            close(connection);
+            return;
+        }
+        request.append(buffer.data(), n_read);
+
+        if (request.size() > MAX_REQUEST_SIZE)
+        {
+            std::string message = std::format("server error: request exceeds {} bytes\n", MAX_REQUEST_SIZE);
+            char status = EXIT_FAILURE;
+            send_frame(connection, FrameKind::ERROR, message.data(), message.size());
+            send_frame(connection, FrameKind::EXIT, &status, 1);
+
+            // the rest of the request is drained so closing does not reset the connection before the
+            // client has read the error
+            shutdown(connection, SHUT_WR);
+            for (ssize_t n_drained; (n_drained = ::read(connection, buffer.data(), buffer.size())) != 0;)
+            {
+                if (n_drained < 0 && errno != EINTR)
+                {
+                    break;
+                }
+            }
+            close(connection);
+            return;
+        }
+    }
+
+    auto separator = request.find('\0');
+    if (separator == std::string::npos)
+    {
+        close(connection);
+        return;
+    }
+    fs::path working_directory = request.substr(0, separator);
+
+    FrameBuffer frames(connection);
+    std::ostream output(&frames);
+
+    char status = EXIT_SUCCESS;
+    try
+    {
+        std::istringstream stream(request.substr(separator + 1));
+        Parser parser(stream, working_directory);
+
+        auto ast = parser.build_ast();
+        ast->prune_conflicting_select();
+
+        Runtime runtime(&m_cache, output);
+        runtime.run(ast->compile());
+        output.flush();
+    }
+    catch(const std::exception& e)
+    {
+        output.flush();
+
+        std::string message = std::string(e.what()) + '\n';
+        send_frame(connection, FrameKind::ERROR, message.data(), message.size());
+        status = EXIT_FAILURE;
+    }
+
+    send_frame(connection, FrameKind::EXIT, &status, 1);
+    close(connection);
+}
+
+int run_client(const fs::path& socket_path, std::istream& script)
+{
+    std::signal(SIGPIPE, SIG_IGN);
+
+    auto address = socket_address(socket_path);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        throw std::runtime_error(std::format("client error: could not connect to {}: {}", socket_path.string(), std::strerror(errno)));
+    }
+
+    std::string source = fs::current_path().string() + '\0';
+    source.append(std::istreambuf_iterator<char>(script), std::istreambuf_iterator<char>());
+    // a server that refuses the script closes its reading side, but still answers with an error frame
+    if ((!write_all(connection, source.data(), source.size()) && errno != EPIPE) || (shutdown(connection, SHUT_WR) < 0 && errno != ENOTCONN))
+    {
+        close(connection);
+        throw std::runtime_error(std::format("client error: could not send script: {}", std::strerror(errno)));
+    }
+
+    std::array<char, 5> header;
+    std::string payload;
+    while (read_all(connection, header.data(), header.size()))
+    {
+        std::uint32_t size = static_cast<unsigned char>(header[1]) | (static_cast<unsigned char>(header[2]) << 8) |
+            (static_cast<unsigned char>(header[3]) << 16) | (static_cast<std::uint32_t>(static_cast<unsigned char>(header[4])) << 24);
+
+        payload.resize(size);
+        if (!read_all(connection, payload.data(), size))
+        {
+            break;
+        }
+
+        switch (static_cast<FrameKind>(header[0]))
+        {
+        case FrameKind::OUTPUT:
+            std::cout.write(payload.data(), size);
+            break;
+        case FrameKind::ERROR:
+            std::cerr.write(payload.data(), size);
+            break;
+        case FrameKind::EXIT:
+            close(connection);
+            std::cout.flush();
+            return size ? payload[0] : EXIT_FAILURE;
+        }
+    }
+
+    close(connection);
+    throw std::runtime_error("client error: connection closed before the script finished");
+}
@@ -0,0 +1,39 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <filesystem>
+#include <iostream>
+
+#include "cache.hpp"
+
+// persistent server that accepts scripts over a unix domain socket. every connection gets its own
+// runtime, while the worker pool and the metadata cache are shared by all of them.
+//
+// a client writes its working directory, a NUL byte and the script, and then shuts down its writing
+// side. relative paths in the script are resolved against the client's working directory. the server
+// then answers with a stream of frames, each made of a one byte kind, a four byte little endian length
+// and the payload:
+//      'o' output produced by the script
+//      'e' error message
+//      'x' exit status of the script (one byte)
+class Server
+{
+    public:
+        Server(const std::filesystem::path& socket_path);
+        ~Server();
+
+        void serve();
+
+    private:
+        void handle(int connection);
+
+    private:
+        std::filesystem::path m_socket_path;
+        int m_socket;
+        MetadataCache m_cache;
+};
+
+// sends a script to a running server and relays its output, returning the script's exit status
+int run_client(const std::filesystem::path& socket_path, std::istream& script);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SHARED_OUTPUT_HPP
+#define SHARED_OUTPUT_HPP
+
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string_view>
+
+// the output of a runtime as the workers of a query see it. every message is written whole under one
+// lock, so the lines of concurrent workers never interleave. per-entry errors go here rather than to
+// std::cout, so a client of the server and the ordered output of a script receive them too.
+class SharedOutput
+{
+    public:
+        SharedOutput(std::ostream& output) : m_output(output) {};
+
+        template<typename... Parts>
+        void print(const Parts&... parts)
+        {
+            std::ostringstream message;
+            (message << ... << parts);
+            write(message.view());
+        };
+
+        void write(std::string_view text)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_output << text;
+        };
+
+    private:
+        std::ostream& m_output;
+        std::mutex m_mutex;
+};
+
+#endif
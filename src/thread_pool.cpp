@@ -0,0 +1,133 @@
+#include "thread_pool.hpp"
+
+#include <utility>
+
+namespace
+{
+    thread_local std::size_t t_worker_index = SIZE_MAX;
+    thread_local TaskGroup* t_current_group = nullptr;
+}
+
+ThreadPool::ThreadPool(std::size_t n_workers) : m_stopping(false)
+{
+    for (std::size_t i = 0; i < n_workers; i++)
+    {
+        m_workers.emplace_back([this, i]() {
+            work(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    // traversal is mostly waiting on the disk, so keep a few workers around even on small machines
+    static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 4u));
+    return pool;
+}
+
+std::size_t ThreadPool::worker_index()
+{
+    return t_worker_index == SIZE_MAX ? shared().size() : t_worker_index;
+}
+
+void ThreadPool::submit(Task&& task)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_tasks.emplace_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::work(std::size_t index)
+{
+    t_worker_index = index;
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty())
+            {
+                return;
+            }
+
+            // newest first keeps traversal depth-first, which bounds the number of queued directories
+            task = std::move(m_tasks.back());
+            m_tasks.pop_back();
+        }
+
+        std::exception_ptr exception;
+        t_current_group = task.m_group;
+        try
+        {
+            task.m_function();
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+        t_current_group = nullptr;
+
+        task.m_group->finish(exception);
+    }
+}
+
+void TaskGroup::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_pending++;
+    }
+    m_pool.submit(ThreadPool::Task{ this, std::move(task) });
+}
+
+void TaskGroup::wait()
+{
+    drain();
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_exception)
+    {
+        std::rethrow_exception(std::exchange(m_exception, nullptr));
+    }
+}
+
+void TaskGroup::drain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_pending == 0; });
+}
+
+TaskGroup* TaskGroup::current()
+{
+    return t_current_group;
+}
+
+void TaskGroup::finish(std::exception_ptr exception)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (exception && !m_exception)
+    {
+        m_exception = exception;
+    }
+    if (--m_pending == 0)
+    {
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+class ThreadPool
+{
+    public:
+        ThreadPool(std::size_t n_workers);
+        ~ThreadPool();
+
+        // process-wide pool shared by every runtime
+        static ThreadPool& shared();
+
+        // index of the calling pool thread, or size() when called from outside the pool
+        static std::size_t worker_index();
+
+        std::size_t size() const { return m_workers.size(); };
+
+    private:
+        friend class TaskGroup;
+
+        struct Task
+        {
+            TaskGroup* m_group;
+            std::function<void()> m_function;
+        };
+
+        void submit(Task&& task);
+        void work(std::size_t index);
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::deque<Task> m_tasks;
+        std::vector<std::thread> m_workers;
+        bool m_stopping;
+};
+
+// a set of tasks that can be waited on together. tasks may submit more tasks to the group they are
+// running in (see current()), and wait() returns once all of them have finished. wait() must not be
+// called from a pool thread.
+class TaskGroup
+{
+    public:
+        TaskGroup(ThreadPool& pool = ThreadPool::shared()) : m_pool(pool), m_pending(0) {};
+        ~TaskGroup() { drain(); };
+
+        void submit(std::function<void()> task);
+        void wait();
+
+        // the group of the task running on the calling thread, or nullptr outside of a task
+        static TaskGroup* current();
+
+    private:
+        friend class ThreadPool;
+
+        void drain();
+        void finish(std::exception_ptr exception);
+
+    private:
+        ThreadPool& m_pool;
+        std::mutex m_mutex;
+        std::condition_variable m_done;
+        std::size_t m_pending;
+        std::exception_ptr m_exception;
+};
+
+// one instance of T per pool thread, so that workers can accumulate without synchronizing. threads
+// outside of the pool share one additional instance behind a mutex.
+template<typename T>
+class PerWorker
+{
+    public:
+        PerWorker() : m_slots(ThreadPool::shared().size() + 1) {};
+
+        template<typename Update>
+        void update(Update update)
+        {
+            auto index = ThreadPool::worker_index();
+            if (index + 1 < m_slots.size())
+            {
+                update(m_slots[index].m_value);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                update(m_slots.back().m_value);
+            }
+        }
+
+        // must only be used once no thread updates anymore
+        template<typename Visit>
+        void for_each(Visit visit)
+        {
+            for (auto& slot : m_slots)
+            {
+                visit(slot.m_value);
+            }
+        }
+
+    private:
+        // padded so that neighbouring workers never share a cache line
+        struct alignas(64) Slot
+        {
+            T m_value;
+        };
+
+        std::vector<Slot> m_slots;
+        std::mutex m_mutex;
+};
+
+#endif
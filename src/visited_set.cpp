@@ -0,0 +1,23 @@
+#include "visited_set.hpp"
+
+VisitedSet::Claim VisitedSet::claim(std::uint64_t device, std::uint64_t inode, std::uint64_t depth)
+{
+    Key key{ device, inode };
+    auto hash = KeyHash()(key);
+
+    // the low bits pick the bucket within a shard, so the shard is picked by the high ones
+    auto& shard = m_shards[(hash >> 58) % N_SHARDS];
+    std::lock_guard<std::mutex> guard(shard.m_mutex);
+    auto [it, inserted] = shard.m_depths.try_emplace(key, depth);
+    if (inserted)
+    {
+        return Claim::FIRST;
+    }
+
+    if (depth < it->second)
+    {
+        it->second = depth;
+        return Claim::SHALLOWER;
+    }
+    return Claim::TAKEN;
+}
@@ -0,0 +1,56 @@
+#ifndef VISITED_SET_HPP
+#define VISITED_SET_HPP
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// the directories a walk that follows symbolic links has claimed, identified by device and inode so that
+// every alias of a directory is the same entry, with the least depth any alias was reached at. the set is
+// split into shards with a lock each, so the workers of a walk rarely wait on each other.
+class VisitedSet
+{
+    public:
+        enum class Claim
+        {
+            // the directory was not in the set yet
+            FIRST,
+            // the directory was in the set, but only at a greater depth
+            SHALLOWER,
+            // the directory was in the set at the same or a lesser depth
+            TAKEN
+        };
+
+        // records the directory at the given depth, unless it was already recorded at that depth or above
+        Claim claim(std::uint64_t device, std::uint64_t inode, std::uint64_t depth);
+
+    private:
+        struct Key
+        {
+            std::uint64_t m_device;
+            std::uint64_t m_inode;
+
+            bool operator==(const Key& other) const = default;
+        };
+
+        struct KeyHash
+        {
+            std::size_t operator()(const Key& key) const
+            {
+                return static_cast<std::size_t>((key.m_inode ^ (key.m_device << 32 | key.m_device >> 32)) * 0x9e3779b97f4a7c15ULL);
+            }
+        };
+
+        static constexpr std::size_t N_SHARDS = 64;
+
+        struct alignas(64) Shard
+        {
+            std::mutex m_mutex;
+            std::unordered_map<Key, std::uint64_t, KeyHash> m_depths;
+        };
+
+        std::array<Shard, N_SHARDS> m_shards;
+};
+
+#endif